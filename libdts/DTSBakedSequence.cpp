@@ -0,0 +1,298 @@
+#include "DTSBakedSequence.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include "DTSSimd.h"
+#include "DTSStream.h"
+
+namespace DTS
+{
+
+TSBakedSequence::TSBakedSequence() :
+	num_nodes_(0), num_keyframes_(0), stride_(0), duration_(0.0f), flags_(0)
+{
+
+}
+
+TSBakedSequence::TSBakedSequence(const TSBakedSequence& other) :
+	TSBakedSequence()
+{
+	*this = other;
+}
+
+TSBakedSequence& TSBakedSequence::operator=(const TSBakedSequence& other)
+{
+	if (this != &other)
+	{
+		Resize(other.num_nodes_, other.num_keyframes_);
+		duration_ = other.duration_;
+		flags_ = other.flags_;
+		if (num_keyframes_)
+			memcpy(GetMutableRow(0), other.GetRow(0), static_cast<std::size_t>(num_keyframes_) * GetRowSize() * sizeof(float));
+	}
+	return *this;
+}
+
+void TSBakedSequence::Resize(int32_t num_nodes, int32_t num_keyframes)
+{
+	num_nodes_ = num_nodes;
+	num_keyframes_ = num_keyframes;
+	stride_ = StrideFor(num_nodes);
+	data_.assign(static_cast<std::size_t>(num_keyframes) * GetRowSize() + kAlign, 0.0f);
+}
+
+const float* TSBakedSequence::GetRow(int32_t keyframe) const
+{
+	assert(keyframe >= 0 && keyframe < num_keyframes_);
+	if (!num_keyframes_)
+		return nullptr;
+
+	// the first row starts at the first aligned float
+	const std::size_t align_bytes = kAlign * sizeof(float);
+	const float* base = &data_[0];
+	std::size_t misalign = reinterpret_cast<std::uintptr_t>(base) % align_bytes;
+	if (misalign)
+		base += (align_bytes - misalign) / sizeof(float);
+
+	return base + static_cast<std::size_t>(keyframe) * GetRowSize();
+}
+
+bool TSBakedSequence::Bake(const TSShape& shape, int32_t seq_index)
+{
+	if (seq_index < 0 || seq_index >= static_cast<int32_t>(shape.sequences_.size()))
+		return false;
+
+	const TSShape::Sequence& seq = shape.sequences_[seq_index];
+	if ((seq.flags_ & TSShape::kBlend) || seq.num_keyframes_ <= 0)
+		return false;
+
+	const int32_t num_nodes = static_cast<int32_t>(shape.nodes_.size());
+	Resize(num_nodes, seq.num_keyframes_);
+	duration_ = seq.duration_;
+	flags_ = seq.flags_;
+
+	std::vector<MatrixF> local_transforms, world_transforms;
+	for (int32_t k = 0; k < num_keyframes_; k++)
+	{
+		if (!shape.SampleKeyframes(seq_index, k, k, 0.0f, &local_transforms))
+		{
+			Resize(0, 0);
+			return false;
+		}
+		shape.GetWorldTransforms(local_transforms, &world_transforms);
+
+		float* row = GetMutableRow(k);
+		for (int32_t i = 0; i < num_nodes; i++)
+		{
+			const float* m = world_transforms[i];
+			for (int32_t c = 0; c < 12; c++)
+				row[c * stride_ + i] = m[c];
+		}
+	}
+
+	return true;
+}
+
+void TSBakedSequence::SelectKeyframes(float time, int32_t* key1, int32_t* key2, float* key_pos) const
+{
+	TSShape::Sequence::SelectKeyframes(time, duration_, num_keyframes_, (flags_ & TSShape::kCyclic) != 0, key1, key2, key_pos);
+}
+
+void TSBakedSequence::Blend(float time, float* pose) const
+{
+	if (!num_keyframes_)
+		return;
+
+	int32_t key1, key2;
+	float key_pos;
+	SelectKeyframes(time, &key1, &key2, &key_pos);
+	Blend(key1, key2, key_pos, pose);
+}
+
+void TSBakedSequence::Blend(int32_t key1, int32_t key2, float key_pos, float* pose) const
+{
+	if (!num_keyframes_)
+		return;
+
+	const float* row1 = GetRow(key1);
+	const float* row2 = GetRow(key2);
+	const int32_t size = GetRowSize();
+	int32_t i = 0;
+
+	// rows are aligned and a whole number of kAlign floats
+#if defined(DTS_AVX2)
+	const __m256 t = _mm256_set1_ps(key_pos);
+	for (; i < size; i += 8)
+	{
+		__m256 a = _mm256_load_ps(row1 + i);
+		__m256 b = _mm256_load_ps(row2 + i);
+		_mm256_storeu_ps(pose + i, _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t)));
+	}
+#elif defined(DTS_SSE2)
+	const __m128 t = _mm_set1_ps(key_pos);
+	for (; i < size; i += 4)
+	{
+		__m128 a = _mm_load_ps(row1 + i);
+		__m128 b = _mm_load_ps(row2 + i);
+		_mm_storeu_ps(pose + i, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t)));
+	}
+#endif
+
+	for (; i < size; i++)
+		pose[i] = row1[i] + (row2[i] - row1[i]) * key_pos;
+}
+
+void TSBakedSequence::GetWorldTransforms(float time, std::vector<MatrixF>* world_transforms) const
+{
+	if (!num_keyframes_)
+	{
+		world_transforms->clear();
+		return;
+	}
+
+	std::vector<float> pose(GetRowSize());
+	Blend(time, &pose[0]);
+	GetWorldTransforms(&pose[0], num_nodes_, world_transforms);
+}
+
+void TSBakedSequence::GetWorldTransforms(const float* pose, int32_t num_nodes, std::vector<MatrixF>* world_transforms)
+{
+	const int32_t stride = StrideFor(num_nodes);
+	world_transforms->resize(num_nodes);
+	for (int32_t i = 0; i < num_nodes; i++)
+	{
+		float* m = (*world_transforms)[i];
+		for (int32_t c = 0; c < 12; c++)
+			m[c] = pose[c * stride + i];
+		m[12] = 0.0f;
+		m[13] = 0.0f;
+		m[14] = 0.0f;
+		m[15] = 1.0f;
+	}
+}
+
+bool TSBakedSequence::LoadFromFile(const std::string& filename, const TSShape& shape)
+{
+	std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+	if (!ifs.is_open())
+	{
+		return false;
+	}
+
+	return LoadFromStream(ifs, shape);
+}
+
+bool TSBakedSequence::LoadFromStream(std::istream& is, const TSShape& shape)
+{
+	// what is left of the stream bounds the keyframes it can hold
+	std::streamoff start = is.tellg();
+	is.seekg(0, std::ios::end);
+	std::streamoff end = is.tellg();
+	is.seekg(start, std::ios::beg);
+	if (start < 0 || end < start || !is.good())
+		return false;
+
+	IStream stream(is);
+
+	int32_t id, version, num_nodes, num_keyframes;
+	float duration;
+	uint32_t flags;
+	stream.Read(&id);
+	stream.Read(&version);
+	if (!stream.Good() || id != kFileId || version != kFileVersion)
+		return false;
+
+	stream.Read(&num_nodes);
+	stream.Read(&num_keyframes);
+	stream.Read(&duration);
+	stream.Read(&flags);
+	if (!stream.Good() || num_nodes != static_cast<int32_t>(shape.nodes_.size()) || num_keyframes < 0)
+		return false;
+
+	const std::size_t header_size = 4 * sizeof(int32_t) + sizeof(float) + sizeof(uint32_t);
+	const std::size_t remaining = static_cast<std::size_t>(end - start);
+	const std::size_t num_floats = static_cast<std::size_t>(num_keyframes) * 12 * StrideFor(num_nodes);
+	if (remaining < header_size || num_floats > (remaining - header_size) / sizeof(float))
+		return false;
+
+	// loaded aside, so a short file leaves this one as it was
+	TSBakedSequence loaded;
+	loaded.Resize(num_nodes, num_keyframes);
+	loaded.duration_ = duration;
+	loaded.flags_ = flags;
+	for (int32_t k = 0; k < num_keyframes; k++)
+	{
+		float* row = loaded.GetMutableRow(k);
+		for (int32_t i = 0; i < loaded.GetRowSize(); i++)
+			stream.Read(&row[i]);
+	}
+	if (!stream.Good())
+		return false;
+
+	*this = std::move(loaded);
+	return true;
+}
+
+bool TSBakedSequence::WriteToFile(const std::string& filename) const
+{
+	std::ofstream ofs(filename, std::ios::out | std::ios::binary);
+	if (!ofs.is_open())
+	{
+		return false;
+	}
+
+	return WriteToStream(ofs);
+}
+
+bool TSBakedSequence::WriteToStream(std::ostream& os) const
+{
+	OStream stream(os);
+
+	stream.Write(kFileId);
+	stream.Write(kFileVersion);
+	stream.Write(num_nodes_);
+	stream.Write(num_keyframes_);
+	stream.Write(duration_);
+	stream.Write(flags_);
+
+	for (int32_t k = 0; k < num_keyframes_; k++)
+	{
+		const float* row = GetRow(k);
+		for (int32_t i = 0; i < GetRowSize(); i++)
+			stream.Write(row[i]);
+	}
+
+	return stream.Flush();
+}
+
+void BakeSequences(const TSShape& shape, std::vector<TSBakedSequence>* baked, int32_t threads)
+{
+	const int32_t num_sequences = static_cast<int32_t>(shape.sequences_.size());
+	baked->assign(num_sequences, TSBakedSequence());
+
+	if (threads <= 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::max(1, std::min(threads, num_sequences));
+
+	// each thread takes the next sequence not yet taken
+	std::atomic<int32_t> next(0);
+	auto bake = [&]()
+	{
+		for (int32_t i = next++; i < num_sequences; i = next++)
+			(*baked)[i].Bake(shape, i);
+	};
+
+	std::vector<std::thread> workers;
+	for (int32_t t = 1; t < threads; t++)
+		workers.emplace_back(bake);
+	bake();
+
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+} // namespace DTS
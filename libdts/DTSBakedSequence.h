@@ -0,0 +1,85 @@
+#ifndef DTS_BAKEDSEQUENCE_H_
+#define DTS_BAKEDSEQUENCE_H_
+
+#include <iostream>
+
+#include "DTSShape.h"
+
+namespace DTS
+{
+
+// Every node's world transform at every keyframe of a sequence, worked out
+// ahead of time so that posing is a blend of two rows: no hierarchy to walk
+// and no keys to decompress.  A row holds the top three rows of each
+// transform as 12 arrays of GetStride() floats (m[0] of every node, then
+// m[1]...), 32 byte aligned.
+class TSBakedSequence
+{
+public:
+	static const int32_t kAlign = 8; // in floats
+
+	TSBakedSequence();
+	// copies lay their rows out again, aligned in their own block
+	TSBakedSequence(const TSBakedSequence& other);
+	TSBakedSequence(TSBakedSequence&& other) = default;
+	TSBakedSequence& operator=(const TSBakedSequence& other);
+	TSBakedSequence& operator=(TSBakedSequence&& other) = default;
+
+	// Blend sequences can't be baked: their keys aren't a pose by themselves.
+	// Nor can a sequence SampleKeyframes refuses, which leaves this empty.
+	bool Bake(const TSShape& shape, int32_t seq_index);
+
+	int32_t GetNumNodes() const { return num_nodes_; }
+	int32_t GetNumKeyframes() const { return num_keyframes_; }
+	int32_t GetStride() const { return stride_; }
+	static int32_t StrideFor(int32_t num_nodes) { return (num_nodes + kAlign - 1) / kAlign * kAlign; }
+	int32_t GetRowSize() const { return 12 * stride_; }
+	// nullptr if there are no keyframes
+	const float* GetRow(int32_t keyframe) const;
+
+	// As Sequence::SelectKeyframes
+	void SelectKeyframes(float time, int32_t* key1, int32_t* key2, float* key_pos) const;
+
+	// Blends the keyframes either side of time into pose, which has room for
+	// GetRowSize() floats.  Linear, so close keyframes are wanted for big
+	// rotations.  Leaves pose alone if there are no keyframes.
+	void Blend(float time, float* pose) const;
+	void Blend(int32_t key1, int32_t key2, float key_pos, float* pose) const;
+
+	// The same, as a transform per node; empty if there are no keyframes
+	void GetWorldTransforms(float time, std::vector<MatrixF>* world_transforms) const;
+
+	// Unpacks a pose laid out as a row
+	static void GetWorldTransforms(const float* pose, int32_t num_nodes, std::vector<MatrixF>* world_transforms);
+
+	// Sidecar files, kept next to the shape.  Loading fails on a file baked
+	// for a shape with another node count, or one that is shorter than its
+	// counts say; is has to be seekable for that to be checked.  A failed
+	// load leaves the sequence as it was.
+	bool LoadFromFile(const std::string& filename, const TSShape& shape);
+	bool LoadFromStream(std::istream& is, const TSShape& shape);
+	bool WriteToFile(const std::string& filename) const;
+	bool WriteToStream(std::ostream& os) const;
+
+private:
+	static const int32_t kFileId = 0x42535444; // "DTSB"
+	static const int32_t kFileVersion = 1;
+
+	float* GetMutableRow(int32_t keyframe) { return const_cast<float*>(GetRow(keyframe)); }
+	void Resize(int32_t num_nodes, int32_t num_keyframes);
+
+	int32_t num_nodes_;
+	int32_t num_keyframes_;
+	int32_t stride_;
+	float duration_;
+	uint32_t flags_;
+	std::vector<float> data_; // kAlign floats over, to align the first row
+};
+
+// Bakes each of a shape's sequences, threads at a time (0 for one per core).
+// Blend sequences are left empty.
+void BakeSequences(const TSShape& shape, std::vector<TSBakedSequence>* baked, int32_t threads = 1);
+
+} // namespace DTS
+
+#endif // DTS_BAKEDSEQUENCE_H_
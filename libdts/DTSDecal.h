@@ -12,8 +12,8 @@ namespace DTS
 class TSDecalMesh
 {
 public:
-	void Assemble(bool skip);
-	void Disassemble();
+	void Assemble(ITSShapeAlloc& alloc);
+	void Disassemble(OTSShapeAlloc& alloc);
 
 	// Topology
 	std::vector<TSDrawPrimitive> primitives_;
@@ -0,0 +1,178 @@
+#include "DTSInstancePoser.h"
+
+#include <algorithm>
+
+#include "DTSSimd.h"
+
+namespace DTS
+{
+
+namespace
+{
+
+// A track once its keyframes are known
+struct Sample
+{
+	int32_t bucket; // the thread whose instances it is on
+	int32_t sequence;
+	int32_t key1;
+	int32_t key2;
+	int32_t instance;
+	float key_pos;
+	float weight;
+
+	bool operator<(const Sample& other) const
+	{
+		if (bucket != other.bucket)
+			return bucket < other.bucket;
+		if (sequence != other.sequence)
+			return sequence < other.sequence;
+		if (key1 != other.key1)
+			return key1 < other.key1;
+		if (key2 != other.key2)
+			return key2 < other.key2;
+		return instance < other.instance;
+	}
+};
+
+// pose = scale * source
+void ScaleInto(const float* source, float scale, float* pose, int32_t size)
+{
+	int32_t i = 0;
+
+#if defined(DTS_AVX2)
+	const __m256 s = _mm256_set1_ps(scale);
+	for (; i + 8 <= size; i += 8)
+		_mm256_storeu_ps(pose + i, _mm256_mul_ps(_mm256_loadu_ps(source + i), s));
+#elif defined(DTS_SSE2)
+	const __m128 s = _mm_set1_ps(scale);
+	for (; i + 4 <= size; i += 4)
+		_mm_storeu_ps(pose + i, _mm_mul_ps(_mm_loadu_ps(source + i), s));
+#endif
+
+	for (; i < size; i++)
+		pose[i] = source[i] * scale;
+}
+
+// pose += scale1 * row1 + scale2 * row2, for aligned rows
+void AddRows(const float* row1, float scale1, const float* row2, float scale2, float* pose, int32_t size)
+{
+	int32_t i = 0;
+
+#if defined(DTS_AVX2)
+	const __m256 s1 = _mm256_set1_ps(scale1);
+	const __m256 s2 = _mm256_set1_ps(scale2);
+	for (; i + 8 <= size; i += 8)
+	{
+		__m256 blend = _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(row1 + i), s1), _mm256_mul_ps(_mm256_load_ps(row2 + i), s2));
+		_mm256_storeu_ps(pose + i, _mm256_add_ps(_mm256_loadu_ps(pose + i), blend));
+	}
+#elif defined(DTS_SSE2)
+	const __m128 s1 = _mm_set1_ps(scale1);
+	const __m128 s2 = _mm_set1_ps(scale2);
+	for (; i + 4 <= size; i += 4)
+	{
+		__m128 blend = _mm_add_ps(_mm_mul_ps(_mm_load_ps(row1 + i), s1), _mm_mul_ps(_mm_load_ps(row2 + i), s2));
+		_mm_storeu_ps(pose + i, _mm_add_ps(_mm_loadu_ps(pose + i), blend));
+	}
+#endif
+
+	for (; i < size; i++)
+		pose[i] += row1[i] * scale1 + row2[i] * scale2;
+}
+
+} // namespace
+
+TSInstancePoser::TSInstancePoser(const TSShape& shape, int32_t threads) :
+	num_nodes_(static_cast<int32_t>(shape.nodes_.size()))
+{
+	BakeSequences(shape, &baked_, threads);
+	SetDefaultPose(shape);
+}
+
+TSInstancePoser::TSInstancePoser(const TSShape& shape, std::vector<TSBakedSequence> baked) :
+	num_nodes_(static_cast<int32_t>(shape.nodes_.size())), baked_(std::move(baked))
+{
+	// any baked for some other shape are left out
+	for (TSBakedSequence& seq : baked_)
+	{
+		if (seq.GetNumKeyframes() && seq.GetNumNodes() != num_nodes_)
+			seq = TSBakedSequence();
+	}
+	SetDefaultPose(shape);
+}
+
+void TSInstancePoser::SetDefaultPose(const TSShape& shape)
+{
+	const int32_t stride = TSBakedSequence::StrideFor(num_nodes_);
+	default_pose_.assign(GetPoseSize(), 0.0f);
+	for (int32_t i = 0; i < num_nodes_; i++)
+	{
+		MatrixF mat;
+		shape.GetNodeWorldTransform(i, &mat);
+
+		const float* m = mat;
+		for (int32_t c = 0; c < 12; c++)
+			default_pose_[c * stride + i] = m[c];
+	}
+}
+
+void TSInstancePoser::Evaluate(const TSInstanceTrack* tracks, int32_t num_tracks, int32_t num_instances,
+	float* poses, TSWorkerPool* pool) const
+{
+	if (num_instances <= 0)
+		return;
+
+	const int32_t threads = std::max(1, std::min(pool ? pool->GetNumThreads() : 1, num_instances));
+	const int32_t chunk = (num_instances + threads - 1) / threads;
+	const int32_t num_buckets = (num_instances + chunk - 1) / chunk;
+	const int32_t size = GetPoseSize();
+
+	// how much of each instance its tracks make up
+	std::vector<float> totals(num_instances, 0.0f);
+	std::vector<Sample> samples;
+	samples.reserve(num_tracks);
+	for (int32_t i = 0; i < num_tracks; i++)
+	{
+		const TSInstanceTrack& track = tracks[i];
+		if (track.instance < 0 || track.instance >= num_instances || track.weight <= 0.0f ||
+			track.sequence < 0 || track.sequence >= static_cast<int32_t>(baked_.size()) || !baked_[track.sequence].GetNumKeyframes())
+			continue;
+
+		Sample sample;
+		sample.bucket = track.instance / chunk;
+		sample.sequence = track.sequence;
+		sample.instance = track.instance;
+		sample.weight = track.weight;
+		baked_[track.sequence].SelectKeyframes(track.time, &sample.key1, &sample.key2, &sample.key_pos);
+		samples.push_back(sample);
+
+		totals[track.instance] += track.weight;
+	}
+	std::sort(samples.begin(), samples.end());
+
+	auto pose_bucket = [&](int32_t bucket)
+	{
+		int32_t first = bucket * chunk;
+		int32_t end = std::min(num_instances, first + chunk);
+		for (int32_t i = first; i < end; i++)
+			ScaleInto(default_pose_.data(), std::max(0.0f, 1.0f - totals[i]), poses + i * size, size);
+
+		std::vector<Sample>::const_iterator it = std::lower_bound(samples.begin(), samples.end(), bucket,
+			[](const Sample& sample, int32_t b) { return sample.bucket < b; });
+		for (; it != samples.end() && it->bucket == bucket; ++it)
+		{
+			const TSBakedSequence& seq = baked_[it->sequence];
+			float scale = it->weight / std::max(1.0f, totals[it->instance]);
+			AddRows(seq.GetRow(it->key1), scale * (1.0f - it->key_pos), seq.GetRow(it->key2), scale * it->key_pos,
+				poses + it->instance * size, size);
+		}
+	};
+
+	if (pool)
+		pool->Run(num_buckets, pose_bucket);
+	else
+		pose_bucket(0);
+}
+
+} // namespace DTS
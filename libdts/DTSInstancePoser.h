@@ -0,0 +1,60 @@
+#ifndef DTS_INSTANCEPOSER_H_
+#define DTS_INSTANCEPOSER_H_
+
+#include "DTSBakedSequence.h"
+#include "DTSWorkerPool.h"
+
+namespace DTS
+{
+
+// A sequence playing on an instance.  An instance's track weights are
+// scaled down to add up to 1 if they come to more, and the default pose
+// makes up the rest if they come to less.
+struct TSInstanceTrack
+{
+	int32_t instance;
+	int32_t sequence;
+	float time;
+	float weight;
+};
+
+// Poses many instances of one shape at a time.  The shape's sequences are
+// baked once and shared, and each instance's pose is blended from their
+// rows into the same layout (see TSBakedSequence): GetPoseSize() floats
+// per instance, back to back.
+class TSInstancePoser
+{
+public:
+	// Bakes the shape's sequences, threads at a time (0 for one per core)
+	explicit TSInstancePoser(const TSShape& shape, int32_t threads = 1);
+	// Uses sequences already baked, e.g. loaded from sidecar files
+	TSInstancePoser(const TSShape& shape, std::vector<TSBakedSequence> baked);
+
+	int32_t GetNumNodes() const { return num_nodes_; }
+	int32_t GetPoseSize() const { return 12 * TSBakedSequence::StrideFor(num_nodes_); }
+	const TSBakedSequence& GetBakedSequence(int32_t seq_index) const { return baked_[seq_index]; }
+
+	// Poses num_instances instances into poses.  Tracks are worked through
+	// by sequence and keyframe, so each row is read while it is in cache,
+	// and the instances are split between pool's threads, if given; it is
+	// the caller's, to be kept from one frame to the next.  Tracks on blend
+	// sequences are ignored.
+	void Evaluate(const TSInstanceTrack* tracks, int32_t num_tracks, int32_t num_instances,
+		float* poses, TSWorkerPool* pool = nullptr) const;
+
+	void GetWorldTransforms(const float* pose, std::vector<MatrixF>* world_transforms) const
+	{
+		TSBakedSequence::GetWorldTransforms(pose, num_nodes_, world_transforms);
+	}
+
+private:
+	void SetDefaultPose(const TSShape& shape);
+
+	int32_t num_nodes_;
+	std::vector<TSBakedSequence> baked_;
+	std::vector<float> default_pose_;
+};
+
+} // namespace DTS
+
+#endif // DTS_INSTANCEPOSER_H_
@@ -22,6 +22,19 @@ inline void TSIntegerSet::Set(int32_t index)
 	bits_[index >> 5] |= 1 << (index & 31);
 }
 
+bool TSIntegerSet::Test(int32_t index) const
+{
+	assert(index >= 0 && index < kMaxSetSize);
+
+	return (bits_[index >> 5] & (1 << (index & 31))) != 0;
+}
+
+void TSIntegerSet::Overlap(const TSIntegerSet& other)
+{
+	for (int32_t i = 0; i < kMaxSetDWords; i++)
+		bits_[i] |= other.bits_[i];
+}
+
 void TSIntegerSet::ClearAll(int32_t upto)
 {
 	assert(upto <= kMaxSetSize);
@@ -59,6 +72,21 @@ void TSIntegerSet::Insert(int32_t index, bool value)
 		Set(index);
 }
 
+void TSIntegerSet::Remap(const int32_t* new_index, int32_t count)
+{
+	assert(count <= kMaxSetSize);
+
+	uint32_t bits[kMaxSetDWords];
+	memcpy(bits, bits_, sizeof(bits));
+	ClearAll();
+
+	for (int32_t i = 0; i < count; i++)
+	{
+		if ((bits[i >> 5] & (1 << (i & 31))) && new_index[i] >= 0)
+			Set(new_index[i]);
+	}
+}
+
 int32_t TSIntegerSet::End() const
 {
 	for (int32_t i = kMaxSetDWords - 1; i >= 0; i--)
@@ -93,6 +121,27 @@ int32_t TSIntegerSet::End() const
 	return 0;
 }
 
+int32_t TSIntegerSet::Next(int32_t index) const
+{
+	index++;
+	for (int32_t i = index >> 5; i < kMaxSetDWords; i++, index = i << 5)
+	{
+		// skip empty dwords, then the clear bits below the first set one
+		uint32_t dword = bits_[i] >> (index & 31);
+		if (dword)
+		{
+			while (!(dword & 1))
+			{
+				dword >>= 1;
+				index++;
+			}
+			return index;
+		}
+	}
+
+	return -1;
+}
+
 bool TSIntegerSet::LoadFromStream(IStream& is)
 {
 	ClearAll();
@@ -22,13 +22,27 @@ public:
 	// Set this bit to true
 	void Set(int32_t index);
 
+	bool Test(int32_t index) const;
+
+	// Sets the bits that are set in other
+	void Overlap(const TSIntegerSet& other);
+
 	// Sets all bits to false
 	void ClearAll(int32_t upto = kMaxSetSize);
 
 	void Insert(int32_t index, bool value);
 
+	// Moves bit i to new_index[i], for i < count; a negative new index drops
+	// the bit.  Bits from count on are cleared.
+	void Remap(const int32_t* new_index, int32_t count);
+
 	int32_t End() const;
 
+	// The lowest set bit, and the next one above index; -1 when there are
+	// no more.  for (i = Start(); i >= 0; i = Next(i)) visits each set bit.
+	int32_t Start() const { return Next(-1); }
+	int32_t Next(int32_t index) const;
+
 	bool LoadFromStream(IStream& is);
 	bool WriteToStream(OStream& os);
 
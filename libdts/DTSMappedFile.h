@@ -0,0 +1,38 @@
+#ifndef DTS_MAPPEDFILE_H_
+#define DTS_MAPPEDFILE_H_
+
+#include <cstdint>
+#include <string>
+
+namespace DTS
+{
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const std::string& filename);
+	void Close();
+
+	const int8_t* GetData() const { return data_; }
+	std::size_t GetSize() const { return size_; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const int8_t* data_;
+	std::size_t size_;
+
+#ifdef _WIN32
+	void* file_;
+	void* mapping_;
+#endif
+};
+
+} // namespace DTS
+
+#endif // DTS_MAPPEDFILE_H_
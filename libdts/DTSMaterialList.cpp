@@ -49,7 +49,7 @@ bool MaterialList::LoadFromStream(IStream& is)
 bool MaterialList::WriteToStream(OStream& os)
 {
 	os.Write(kBinaryFileVersion);					// version
-	os.Write(material_names_.size());				// material count
+	os.Write(static_cast<uint32_t>(material_names_.size()));	// material count
 
 	uint32_t i;
 	for (i = 0; i < material_names_.size(); i++)	// material names
@@ -58,7 +58,7 @@ bool MaterialList::WriteToStream(OStream& os)
 	return os.Good();
 }
 
-bool TSMaterialList::LoadFromStream(IStream& is)
+bool TSMaterialList::LoadFromStream(IStream& is, int32_t read_version)
 {
 	if (!MaterialList::LoadFromStream(is))
 		return false;
@@ -75,7 +75,7 @@ bool TSMaterialList::LoadFromStream(IStream& is)
 	for (i = 0; i < Size(); i++)
 		is.Read(&detail_maps_[i]);
 
-	if (TSShape::current_read_version_ == 25)
+	if (read_version == 25)
 	{
 		uint32_t dummy = 0;
 
@@ -86,7 +86,7 @@ bool TSMaterialList::LoadFromStream(IStream& is)
 	for (i = 0; i < Size(); i++)
 		is.Read(&detail_scales_[i]);
 
-	if (TSShape::current_read_version_ > 20)
+	if (read_version > 20)
 	{
 		for (i = 0; i < Size(); i++)
 			is.Read(&reflection_amounts_[i]);
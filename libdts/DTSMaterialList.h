@@ -13,6 +13,7 @@ class MaterialList
 {
 public:
 	uint32_t Size() const { return static_cast<uint32_t>(material_names_.size()); }
+	const std::string& GetMaterialName(uint32_t index) const { return material_names_[index]; }
 
 	bool LoadFromStream(IStream& is);
 	bool WriteToStream(OStream& os);
@@ -41,7 +42,7 @@ public:
 		kAuxiliaryMap = 0x8000000 | 0x10000000 | 0x20000000 | 0x40000000 | 0x80000000 // DEPRECATED
 	};
 
-	bool LoadFromStream(IStream& is);
+	bool LoadFromStream(IStream& is, int32_t read_version);
 	bool WriteToStream(OStream& os);
 
 private:
@@ -35,6 +35,8 @@ public:
 	// Set the position of the matrix.
 	void SetPosition(const Point3F& pos) { SetColumn(3, pos); }
 
+	MatrixF& Scale(const Point3F& s);					// M * diag(s) -> M
+
 	MatrixF& Mul(const MatrixF& a);						// M * a -> M
 	MatrixF& Mul(const MatrixF& a, const MatrixF& b);	// a * b -> M
 
@@ -112,6 +114,23 @@ inline Point3F MatrixF::GetPosition() const
 	return Point3F(m_[3], m_[3 + 4], m_[3 + 8]);
 }
 
+inline MatrixF& MatrixF::Scale(const Point3F& s)
+{
+	m_[0] *= s.x;
+	m_[1] *= s.y;
+	m_[2] *= s.z;
+	m_[4] *= s.x;
+	m_[5] *= s.y;
+	m_[6] *= s.z;
+	m_[8] *= s.x;
+	m_[9] *= s.y;
+	m_[10] *= s.z;
+	m_[12] *= s.x;
+	m_[13] *= s.y;
+	m_[14] *= s.z;
+	return (*this);
+}
+
 inline MatrixF& MatrixF::Mul(const MatrixF& a)
 {
 	assert(&a != this);
@@ -1,14 +1,24 @@
 #include "DTSMesh.h"
 
+#include <algorithm>
+#include <cmath>
+
 #include "DTSDecal.h"
+#include "DTSSimd.h"
 #include "DTSSortedMesh.h"
 #include "DTSShape.h"
 
+#if defined(DTS_AVX2)
+#define DTS_NORMAL_LANES 8
+#elif defined(DTS_SSE2)
+#define DTS_NORMAL_LANES 4
+#else
+#define DTS_NORMAL_LANES 1
+#endif
+
 namespace DTS
 {
 
-#define tsalloc TSShape::alloc_
-
 const Point3F TSMesh::kU8ToNormalTable[]{
 	Point3F(0.565061f, -0.270644f, -0.779396f),
 	Point3F(-0.309804f, -0.731114f, 0.607860f),
@@ -268,21 +278,6 @@ const Point3F TSMesh::kU8ToNormalTable[]{
 	Point3F(0.194979f, -0.059120f, 0.979024f)
 };
 
-// structures used to share data between detail levels...
-// used (and valid) during load only
-std::vector<Point3F*>	TSMesh::verts_list_;
-std::vector<Point3F*>	TSMesh::norms_list_;
-std::vector<uint8_t*>	TSMesh::encoded_norms_list_;
-std::vector<Point2F*>	TSMesh::tverts_list_;
-
-std::vector<bool>		TSMesh::data_copied_;
-
-std::vector<MatrixF*>	TSSkinMesh::init_transform_list_;
-std::vector<int32_t*>	TSSkinMesh::vertex_index_list_;
-std::vector<int32_t*>	TSSkinMesh::bone_index_list_;
-std::vector<float*>		TSSkinMesh::weight_list_;
-std::vector<int32_t*>	TSSkinMesh::node_index_list_;
-
 TSMesh::TSMesh() :
 	mesh_type_(kStandardMeshType)
 {
@@ -293,6 +288,7 @@ void TSMesh::ComputeBounds()
 {
 	MatrixF mat(true);
 	ComputeBounds(mat, bounds_, -1, &center_, &radius_);
+	SetDirty();
 }
 
 void TSMesh::ComputeBounds(const MatrixF& transform, Box3F& bounds, int32_t frame, Point3F* center, float* radius)
@@ -358,13 +354,136 @@ void TSMesh::ComputeBounds(const Point3F* v, int32_t num_verts, int32_t stride,
 	}
 }
 
-uint8_t TSMesh::EncodeNormal(const Point3F& normal)
+namespace
+{
+
+const int32_t kNumEncodedNormals = 256;
+
+// Cube map over the sphere of directions.  Each cell lists, in ascending
+// order, every table normal that can be the closest one to some direction in
+// the cell (with room for rounding), so encoding only has to test those.
+class NormalLookup
+{
+public:
+	static const int32_t kCellsPerSide = 16;
+
+	NormalLookup();
+
+	void GetCandidates(int32_t cell, const uint8_t** first, const uint8_t** last) const
+	{
+		*first = Vector::Address(candidates_) + cell_start_[cell];
+		*last = Vector::Address(candidates_) + cell_start_[cell + 1];
+	}
+
+	// the cell of a normal that is neither tiny nor huge
+	static int32_t GetCell(const float* v)
+	{
+		float ax = fabsf(v[0]), ay = fabsf(v[1]), az = fabsf(v[2]);
+		int32_t axis = (ax >= ay && ax >= az) ? 0 : (ay >= az ? 1 : 2);
+		float major = fabsf(v[axis]);
+		int32_t face = 2 * axis + (v[axis] < 0.0f ? 1 : 0);
+		int32_t i = GetCellCoord(v[(axis + 1) % 3] / major);
+		int32_t j = GetCellCoord(v[(axis + 2) % 3] / major);
+		return (face * kCellsPerSide + j) * kCellsPerSide + i;
+	}
+
+	static int32_t GetCellCoord(float u)
+	{
+		int32_t i = static_cast<int32_t>((u + 1.0f) * 0.5f * kCellsPerSide);
+		return std::min(std::max(i, 0), kCellsPerSide - 1);
+	}
+
+private:
+	static void GetDirection(int32_t face, double u, double v, double* dir);
+
+	std::vector<uint8_t> candidates_;
+	std::vector<int32_t> cell_start_;
+};
+
+void NormalLookup::GetDirection(int32_t face, double u, double v, double* dir)
+{
+	int32_t axis = face / 2;
+	dir[axis] = (face & 1) ? -1.0 : 1.0;
+	dir[(axis + 1) % 3] = u;
+	dir[(axis + 2) % 3] = v;
+
+	double len = sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+	for (int32_t k = 0; k < 3; k++)
+		dir[k] /= len;
+}
+
+NormalLookup::NormalLookup()
+{
+	const double kPi = 3.14159265358979323846;
+	const double kAnglePad = 1e-3;	// generous cover for cell assignment of rounded directions
+	const double kDotPad = 1e-4;	// and for rounding in the dot products
+
+	const int32_t num_cells = 6 * kCellsPerSide * kCellsPerSide;
+	cell_start_.reserve(num_cells + 1);
+
+	double lengths[kNumEncodedNormals];
+	for (int32_t n = 0; n < kNumEncodedNormals; n++)
+	{
+		const Point3F& p = TSMesh::kU8ToNormalTable[n];
+		lengths[n] = sqrt(double(p.x) * p.x + double(p.y) * p.y + double(p.z) * p.z);
+	}
+
+	for (int32_t cell = 0; cell < num_cells; cell++)
+	{
+		int32_t face = cell / (kCellsPerSide * kCellsPerSide);
+		int32_t i = cell % kCellsPerSide;
+		int32_t j = (cell / kCellsPerSide) % kCellsPerSide;
+		double u0 = -1.0 + 2.0 * i / kCellsPerSide, u1 = -1.0 + 2.0 * (i + 1) / kCellsPerSide;
+		double v0 = -1.0 + 2.0 * j / kCellsPerSide, v1 = -1.0 + 2.0 * (j + 1) / kCellsPerSide;
+
+		// the cell as a cone: the farthest point from its center is a corner
+		double center[3], corner[3];
+		GetDirection(face, 0.5 * (u0 + u1), 0.5 * (v0 + v1), center);
+		double radius = 0.0;
+		for (int32_t c = 0; c < 4; c++)
+		{
+			GetDirection(face, (c & 1) ? u1 : u0, (c & 2) ? v1 : v0, corner);
+			double dot = center[0] * corner[0] + center[1] * corner[1] + center[2] * corner[2];
+			radius = std::max(radius, acos(std::min(1.0, dot)));
+		}
+		radius += kAnglePad;
+
+		// bound each normal's dot product over the cone
+		double lower[kNumEncodedNormals], upper[kNumEncodedNormals];
+		double best_lower = -2.0;
+		for (int32_t n = 0; n < kNumEncodedNormals; n++)
+		{
+			const Point3F& p = TSMesh::kU8ToNormalTable[n];
+			double cosine = (center[0] * p.x + center[1] * p.y + center[2] * p.z) / lengths[n];
+			double angle = acos(std::max(-1.0, std::min(1.0, cosine)));
+			lower[n] = lengths[n] * cos(std::min(kPi, angle + radius));
+			upper[n] = lengths[n] * cos(std::max(0.0, angle - radius));
+			best_lower = std::max(best_lower, lower[n]);
+		}
+
+		cell_start_.push_back(candidates_.size());
+		for (int32_t n = 0; n < kNumEncodedNormals; n++)
+		{
+			if (upper[n] >= best_lower - kDotPad)
+				candidates_.push_back(static_cast<uint8_t>(n));
+		}
+	}
+	cell_start_.push_back(candidates_.size());
+}
+
+const NormalLookup& GetNormalLookup()
+{
+	static const NormalLookup lookup;
+	return lookup;
+}
+
+uint8_t EncodeNormalBruteForce(const Point3F& normal)
 {
 	uint8_t best_index = 0;
 	float best_dot = -10E30f;
-	for (uint32_t i = 0; i < 256; i++)
+	for (uint32_t i = 0; i < kNumEncodedNormals; i++)
 	{
-		float dot = Math::Dot(normal, kU8ToNormalTable[i]);
+		float dot = Math::Dot(normal, TSMesh::kU8ToNormalTable[i]);
 		if (dot > best_dot)
 		{
 			best_index = i;
@@ -374,52 +493,247 @@ uint8_t TSMesh::EncodeNormal(const Point3F& normal)
 	return best_index;
 }
 
-TSMesh* TSMesh::AssembleMesh(uint32_t mesh_type, bool skip)
+// zero, tiny, huge and non-finite normals can tie or round away from the
+// cell's candidates, so they take the long way
+inline bool CanUseLookup(const Point3F& normal)
+{
+	float len_sq = Math::Dot(normal, normal);
+	return len_sq >= 1e-20f && len_sq <= 1e20f;
+}
+
+uint8_t SearchCell(const NormalLookup& lookup, int32_t cell, const Point3F& normal)
+{
+	const uint8_t* candidate;
+	const uint8_t* last;
+	lookup.GetCandidates(cell, &candidate, &last);
+
+	// same comparison as the brute force search over ascending indices, so
+	// ties go to the same normal
+	uint8_t best_index = 0;
+	float best_dot = -10E30f;
+	for (; candidate != last; candidate++)
+	{
+		float dot = Math::Dot(normal, TSMesh::kU8ToNormalTable[*candidate]);
+		if (dot > best_dot)
+		{
+			best_index = *candidate;
+			best_dot = dot;
+		}
+	}
+	return best_index;
+}
+
+uint8_t EncodeNormalWithLookup(const NormalLookup& lookup, const Point3F& normal)
+{
+	if (!CanUseLookup(normal))
+		return EncodeNormalBruteForce(normal);
+	return SearchCell(lookup, NormalLookup::GetCell(&normal.x), normal);
+}
+
+#if DTS_NORMAL_LANES > 1
+
+static_assert(sizeof(Point3F) == 3 * sizeof(float), "normals are read as packed floats");
+
+// x, y and z of 4 normals
+inline void LoadNormals4(const Point3F* n, __m128* x, __m128* y, __m128* z)
+{
+	const float* f = &n->x;
+	__m128 a = _mm_loadu_ps(f);     // x0 y0 z0 x1
+	__m128 b = _mm_loadu_ps(f + 4); // y1 z1 x2 y2
+	__m128 c = _mm_loadu_ps(f + 8); // z2 x3 y3 z3
+	*x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+	*y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+	*z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), c, _MM_SHUFFLE(3, 0, 2, 0));
+}
+
+#endif
+
+#if DTS_NORMAL_LANES == 8
+
+typedef __m256 Lanes;
+typedef __m256i IntLanes;
+
+inline void LoadNormals(const Point3F* n, Lanes* x, Lanes* y, Lanes* z)
+{
+	__m128 x0, y0, z0, x1, y1, z1;
+	LoadNormals4(n, &x0, &y0, &z0);
+	LoadNormals4(n + 4, &x1, &y1, &z1);
+	*x = _mm256_insertf128_ps(_mm256_castps128_ps256(x0), x1, 1);
+	*y = _mm256_insertf128_ps(_mm256_castps128_ps256(y0), y1, 1);
+	*z = _mm256_insertf128_ps(_mm256_castps128_ps256(z0), z1, 1);
+}
+
+inline Lanes Splat(float f) { return _mm256_set1_ps(f); }
+inline Lanes Add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+inline Lanes Mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+inline Lanes Div(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+inline Lanes Min(Lanes a, Lanes b) { return _mm256_min_ps(a, b); }
+inline Lanes Max(Lanes a, Lanes b) { return _mm256_max_ps(a, b); } // b where a is NaN
+inline Lanes And(Lanes a, Lanes b) { return _mm256_and_ps(a, b); }
+inline Lanes AndNot(Lanes a, Lanes b) { return _mm256_andnot_ps(a, b); } // ~a & b
+inline Lanes Less(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline Lanes GreaterEqual(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+inline Lanes LessEqual(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline Lanes Select(Lanes mask, Lanes a, Lanes b) { return _mm256_blendv_ps(b, a, mask); }
+inline int32_t MoveMask(Lanes a) { return _mm256_movemask_ps(a); }
+inline IntLanes Truncate(Lanes a) { return _mm256_cvttps_epi32(a); }
+inline IntLanes AddInt(IntLanes a, IntLanes b) { return _mm256_add_epi32(a, b); }
+inline IntLanes ShiftLeft4(IntLanes a) { return _mm256_slli_epi32(a, 4); }
+inline void StoreInt(int32_t* out, IntLanes a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), a); }
+
+#elif DTS_NORMAL_LANES == 4
+
+typedef __m128 Lanes;
+typedef __m128i IntLanes;
+
+inline void LoadNormals(const Point3F* n, Lanes* x, Lanes* y, Lanes* z) { LoadNormals4(n, x, y, z); }
+
+inline Lanes Splat(float f) { return _mm_set1_ps(f); }
+inline Lanes Add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+inline Lanes Mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+inline Lanes Div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+inline Lanes Min(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+inline Lanes Max(Lanes a, Lanes b) { return _mm_max_ps(a, b); } // b where a is NaN
+inline Lanes And(Lanes a, Lanes b) { return _mm_and_ps(a, b); }
+inline Lanes AndNot(Lanes a, Lanes b) { return _mm_andnot_ps(a, b); } // ~a & b
+inline Lanes Less(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+inline Lanes GreaterEqual(Lanes a, Lanes b) { return _mm_cmpge_ps(a, b); }
+inline Lanes LessEqual(Lanes a, Lanes b) { return _mm_cmple_ps(a, b); }
+inline Lanes Select(Lanes mask, Lanes a, Lanes b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+inline int32_t MoveMask(Lanes a) { return _mm_movemask_ps(a); }
+inline IntLanes Truncate(Lanes a) { return _mm_cvttps_epi32(a); }
+inline IntLanes AddInt(IntLanes a, IntLanes b) { return _mm_add_epi32(a, b); }
+inline IntLanes ShiftLeft4(IntLanes a) { return _mm_slli_epi32(a, 4); }
+inline void StoreInt(int32_t* out, IntLanes a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(out), a); }
+
+#endif
+
+#if DTS_NORMAL_LANES > 1
+
+// NormalLookup::GetCell for a lane's worth of normals, with the same float
+// operations so the cells are the same.  Returns a bit per normal that can
+// use the lookup (see CanUseLookup).
+int32_t GetCells(const Point3F* normals, int32_t* cells)
+{
+	static_assert(NormalLookup::kCellsPerSide == 16, "cells are combined with 4 bit shifts");
+
+	Lanes x, y, z;
+	LoadNormals(normals, &x, &y, &z);
+
+	Lanes len_sq = Add(Add(Mul(x, x), Mul(y, y)), Mul(z, z));
+	int32_t usable = MoveMask(And(GreaterEqual(len_sq, Splat(1e-20f)), LessEqual(len_sq, Splat(1e20f))));
+
+	// the major axis, first of any ties as in GetCell
+	const Lanes sign = Splat(-0.0f);
+	Lanes ax = AndNot(sign, x), ay = AndNot(sign, y), az = AndNot(sign, z);
+	Lanes on_x = And(GreaterEqual(ax, ay), GreaterEqual(ax, az));
+	Lanes on_y = AndNot(on_x, GreaterEqual(ay, az));
+
+	Lanes major = Select(on_x, ax, Select(on_y, ay, az));
+	Lanes along = Select(on_x, x, Select(on_y, y, z));
+	Lanes u = Select(on_x, y, Select(on_y, z, x));
+	Lanes v = Select(on_x, z, Select(on_y, x, y));
+	Lanes face = Add(Select(on_x, Splat(0.0f), Select(on_y, Splat(2.0f), Splat(4.0f))), And(Less(along, Splat(0.0f)), Splat(1.0f)));
+
+	// clamped before truncating rather than after, which comes to the same
+	// for coordinates in range and keeps lanes that can't use the lookup in it
+	const Lanes half = Splat(0.5f);
+	const Lanes cells_per_side = Splat(static_cast<float>(NormalLookup::kCellsPerSide));
+	const Lanes last_cell = Splat(static_cast<float>(NormalLookup::kCellsPerSide - 1));
+	Lanes i = Min(Max(Mul(Mul(Add(Div(u, major), Splat(1.0f)), half), cells_per_side), Splat(0.0f)), last_cell);
+	Lanes j = Min(Max(Mul(Mul(Add(Div(v, major), Splat(1.0f)), half), cells_per_side), Splat(0.0f)), last_cell);
+
+	StoreInt(cells, AddInt(ShiftLeft4(AddInt(ShiftLeft4(Truncate(face)), Truncate(j))), Truncate(i)));
+	return usable;
+}
+
+#endif
+
+} // namespace
+
+uint8_t TSMesh::EncodeNormal(const Point3F& normal)
+{
+	return EncodeNormalWithLookup(GetNormalLookup(), normal);
+}
+
+void TSMesh::EncodeNormals(const Point3F* normals, uint8_t* encoded, int32_t count)
+{
+	const NormalLookup& lookup = GetNormalLookup();
+	int32_t i = 0;
+
+#if DTS_NORMAL_LANES > 1
+	// the cells a lane's worth at a time, then each normal's candidates
+	int32_t cells[DTS_NORMAL_LANES];
+	for (; i + DTS_NORMAL_LANES <= count; i += DTS_NORMAL_LANES)
+	{
+		int32_t usable = GetCells(normals + i, cells);
+		for (int32_t k = 0; k < DTS_NORMAL_LANES; k++)
+		{
+			encoded[i + k] = (usable & (1 << k)) ? SearchCell(lookup, cells[k], normals[i + k]) :
+				EncodeNormalBruteForce(normals[i + k]);
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+		encoded[i] = EncodeNormalWithLookup(lookup, normals[i]);
+}
+
+void TSMesh::WriteEncodedNormals(OTSShapeAlloc& alloc) const
+{
+	if (encoded_norms_.size())
+	{
+		alloc.OMemBuffer8::CopyToBuffer(reinterpret_cast<const int8_t*>(Vector::Address(encoded_norms_)), norms_.size());
+		return;
+	}
+
+	// compute encoded normals a batch at a time
+	const int32_t kBatchSize = 256;
+	uint8_t encoded[kBatchSize];
+	for (int32_t i = 0; i < static_cast<int32_t>(norms_.size()); i += kBatchSize)
+	{
+		int32_t count = std::min<int32_t>(kBatchSize, norms_.size() - i);
+		EncodeNormals(Vector::Address(norms_) + i, encoded, count);
+		alloc.OMemBuffer8::CopyToBuffer(reinterpret_cast<int8_t*>(encoded), count);
+	}
+}
+
+int32_t TSMesh::GetMaxMeshSize()
 {
-	static TSMesh temp_standard_mesh;
-	static TSSkinMesh temp_skin_mesh;
-	static TSDecalMesh temp_decal_mesh;
-	static TSSortedMesh temp_sorted_mesh;
+	return static_cast<int32_t>(std::max(std::max(sizeof(TSMesh), sizeof(TSSkinMesh)),
+		std::max(sizeof(TSDecalMesh), sizeof(TSSortedMesh))));
+}
 
-	bool just_size = skip | !tsalloc.IMemBuffer32::AllocShape(0); // if this returns NULL, we're just sizing memory block
+TSMesh* TSMesh::AssembleMesh(ITSShapeAlloc& alloc, uint32_t mesh_type, bool skip)
+{
+	// skipped meshes are read into scratch meshes that take up no room in the shape;
+	// local so that concurrent loads don't share them
+	TSMesh temp_standard_mesh;
+	TSSkinMesh temp_skin_mesh;
+	TSDecalMesh temp_decal_mesh;
+	TSSortedMesh temp_sorted_mesh;
 
 	// a little funny business because we pretend decals are derived from meshes
 	int32_t* ret = nullptr;
 	TSMesh* mesh = nullptr;
 	TSDecalMesh* decal = nullptr;
 
-	if (just_size)
+	if (skip)
 	{
 		switch (mesh_type)
 		{
 			case kStandardMeshType:
-			{
-				ret = reinterpret_cast<int32_t*>(&temp_standard_mesh);
 				mesh = &temp_standard_mesh;
-				tsalloc.IMemBuffer32::AllocShape(sizeof(TSMesh) >> 2);
 				break;
-			}
 			case kSkinMeshType:
-			{
-				ret = reinterpret_cast<int32_t*>(&temp_skin_mesh);
 				mesh = &temp_skin_mesh;
-				tsalloc.IMemBuffer32::AllocShape(sizeof(TSSkinMesh) >> 2);
 				break;
-			}
 			case kDecalMeshType:
-			{
-				ret = reinterpret_cast<int32_t*>(&temp_decal_mesh);
 				decal = &temp_decal_mesh;
-				tsalloc.IMemBuffer32::AllocShape(sizeof(TSDecalMesh) >> 2);
 				break;
-			}
 			case kSortedMeshType:
-			{
-				ret = reinterpret_cast<int32_t*>(&temp_sorted_mesh);
 				mesh = &temp_sorted_mesh;
-				tsalloc.IMemBuffer32::AllocShape(sizeof(TSSortedMesh) >> 2);
 				break;
-			}
 		}
 	}
 	else
@@ -428,28 +742,28 @@ TSMesh* TSMesh::AssembleMesh(uint32_t mesh_type, bool skip)
 		{
 			case kStandardMeshType:
 			{
-				ret = tsalloc.IMemBuffer32::AllocShape(sizeof(TSMesh) >> 2);
+				ret = alloc.IMemBuffer32::AllocShape(sizeof(TSMesh) >> 2);
 				new (ret) TSMesh;
 				mesh = reinterpret_cast<TSMesh*>(ret);
 				break;
 			}
 			case kSkinMeshType:
 			{
-				ret = tsalloc.IMemBuffer32::AllocShape(sizeof(TSSkinMesh) >> 2);
+				ret = alloc.IMemBuffer32::AllocShape(sizeof(TSSkinMesh) >> 2);
 				new (ret) TSSkinMesh;
 				mesh = reinterpret_cast<TSSkinMesh*>(ret);
 				break;
 			}
 			case kDecalMeshType:
 			{
-				ret = tsalloc.IMemBuffer32::AllocShape(sizeof(TSDecalMesh) >> 2);
+				ret = alloc.IMemBuffer32::AllocShape(sizeof(TSDecalMesh) >> 2);
 				new (ret) TSDecalMesh;
 				decal = reinterpret_cast<TSDecalMesh*>(ret);
 				break;
 			}
 			case kSortedMeshType:
 			{
-				ret = tsalloc.IMemBuffer32::AllocShape(sizeof(TSSortedMesh) >> 2);
+				ret = alloc.IMemBuffer32::AllocShape(sizeof(TSSortedMesh) >> 2);
 				new (ret) TSSortedMesh;
 				mesh = reinterpret_cast<TSSortedMesh*>(ret);
 				break;
@@ -457,51 +771,115 @@ TSMesh* TSMesh::AssembleMesh(uint32_t mesh_type, bool skip)
 		}
 	}
 
-	tsalloc.SetSkipMode(skip);
+	alloc.SetSkipMode(skip);
 
 	if (mesh)
-		mesh->Assemble(skip);
+		mesh->Assemble(alloc);
 
 	if (decal)
-		decal->Assemble(skip);
+		decal->Assemble(alloc);
 
-	tsalloc.SetSkipMode(false);
+	alloc.SetSkipMode(false);
 
+	// nullptr for skipped meshes
 	return reinterpret_cast<TSMesh*>(ret);
 }
 
-void TSMesh::Assemble(bool skip)
+void TSMesh::SkipMesh(ITSShapeAlloc& alloc, uint32_t mesh_type, int32_t mesh_index)
+{
+	switch (mesh_type)
+	{
+		case kStandardMeshType:
+			TSMesh::Skip(alloc, mesh_index);
+			break;
+		case kSkinMeshType:
+			TSSkinMesh::Skip(alloc, mesh_index);
+			break;
+		case kDecalMeshType:
+			// DEPRECATED, not worth a separate walk
+			AssembleMesh(alloc, mesh_type, true);
+			break;
+		case kSortedMeshType:
+			TSSortedMesh::Skip(alloc, mesh_index);
+			break;
+	}
+}
+
+int32_t TSMesh::Skip(ITSShapeAlloc& alloc, int32_t mesh_index)
+{
+	// must follow the layout read by Assemble
+	alloc.CheckGuard();
+
+	alloc.IMemBuffer32::GetPointer(2); // num_frames, num_mat_frames
+	int32_t parent_mesh = alloc.IMemBuffer32::Get();
+	alloc.IMemBuffer32::GetPointer(10); // bounds, center, radius
+
+	int32_t num_verts = alloc.IMemBuffer32::Get();
+	SkipSharedData<int32_t>(alloc, parent_mesh, 3 * num_verts, alloc.verts_list_, mesh_index);
+
+	int32_t num_tverts = alloc.IMemBuffer32::Get();
+	SkipSharedData<int32_t>(alloc, parent_mesh, 2 * num_tverts, alloc.tverts_list_, mesh_index);
+
+	if (alloc.GetReadVersion() > 21)
+	{
+		SkipSharedData<int32_t>(alloc, parent_mesh, 3 * num_verts, alloc.norms_list_, mesh_index);
+		SkipSharedData<int8_t>(alloc, parent_mesh, num_verts, alloc.encoded_norms_list_, mesh_index);
+	}
+	else
+	{
+		// no encoded normals...
+		alloc.norms_list_[mesh_index] = reinterpret_cast<Point3F*>(alloc.IMemBuffer32::GetPointer(3 * num_verts));
+		alloc.encoded_norms_list_[mesh_index] = nullptr;
+	}
+
+	int32_t sz = alloc.IMemBuffer32::Get();
+	alloc.IMemBuffer16::GetPointer(sz * 2);
+	alloc.IMemBuffer32::GetPointer(sz);
+	sz = alloc.IMemBuffer32::Get();
+	alloc.IMemBuffer16::GetPointer(sz);
+
+	sz = alloc.IMemBuffer32::Get();
+	alloc.IMemBuffer16::GetPointer(sz); // merge indices
+
+	alloc.IMemBuffer32::GetPointer(2); // verts_per_frame, flags
+
+	alloc.CheckGuard();
+
+	return parent_mesh;
+}
+
+void TSMesh::Assemble(ITSShapeAlloc& alloc)
 {
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
-	num_frames_ = tsalloc.IMemBuffer32::Get();
-	num_mat_frames_ = tsalloc.IMemBuffer32::Get();
-	parent_mesh_ = tsalloc.IMemBuffer32::Get();
-	tsalloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&bounds_), 6);
-	tsalloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&center_), 3);
-	radius_ = static_cast<float>(tsalloc.IMemBuffer32::Get());
+	num_frames_ = alloc.IMemBuffer32::Get();
+	num_mat_frames_ = alloc.IMemBuffer32::Get();
+	parent_mesh_ = alloc.IMemBuffer32::Get();
+	alloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&bounds_), 6);
+	alloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&center_), 3);
+	radius_ = static_cast<float>(alloc.IMemBuffer32::Get());
 
-	int32_t num_verts = tsalloc.IMemBuffer32::Get();
-	int32_t* ptr32 = GetSharedData<int32_t>(parent_mesh_, 3 * num_verts, reinterpret_cast<int32_t**>(Vector::Address(verts_list_)), skip);
+	int32_t num_verts = alloc.IMemBuffer32::Get();
+	int32_t* ptr32 = GetSharedData<int32_t>(alloc, parent_mesh_, 3 * num_verts, reinterpret_cast<int32_t**>(Vector::Address(alloc.verts_list_)));
 	Vector::Set(verts_, ptr32, num_verts);
 
-	int32_t num_tverts = tsalloc.IMemBuffer32::Get();
-	ptr32 = GetSharedData<int32_t>(parent_mesh_, 2 * num_tverts, reinterpret_cast<int32_t**>(Vector::Address(tverts_list_)), skip);
+	int32_t num_tverts = alloc.IMemBuffer32::Get();
+	ptr32 = GetSharedData<int32_t>(alloc, parent_mesh_, 2 * num_tverts, reinterpret_cast<int32_t**>(Vector::Address(alloc.tverts_list_)));
 	Vector::Set(tverts_, ptr32, num_tverts);
 
 	int8_t* ptr8;
-	if (TSShape::current_read_version_ > 21)
+	if (alloc.GetReadVersion() > 21)
 	{
-		ptr32 = GetSharedData<int32_t>(parent_mesh_, 3 * num_verts, reinterpret_cast<int32_t**>(Vector::Address(norms_list_)), skip);
+		ptr32 = GetSharedData<int32_t>(alloc, parent_mesh_, 3 * num_verts, reinterpret_cast<int32_t**>(Vector::Address(alloc.norms_list_)));
 		Vector::Set(norms_, ptr32, num_verts);
 
-		ptr8 = GetSharedData<int8_t>(parent_mesh_, num_verts, reinterpret_cast<int8_t**>(Vector::Address(encoded_norms_list_)), skip);
+		ptr8 = GetSharedData<int8_t>(alloc, parent_mesh_, num_verts, reinterpret_cast<int8_t**>(Vector::Address(alloc.encoded_norms_list_)));
 		Vector::Set(encoded_norms_, ptr8, num_verts);
 	}
 	else
 	{
 		// no encoded normals...
-		ptr32 = tsalloc.IMemBuffer32::CopyToShape(3 * num_verts);
+		ptr32 = alloc.IMemBuffer32::GetPointer(3 * num_verts);
 		Vector::Set(norms_, ptr32, num_verts);
 		Vector::Set(encoded_norms_, nullptr, 0);
 	}
@@ -511,12 +889,12 @@ void TSMesh::Assemble(bool skip)
 	int32_t *ind;
 
 	// mesh primitives (start, num_elements) indices are stored as 16 bit values
-	szPrim = tsalloc.IMemBuffer32::Get();
-	int16_t* prim16 = tsalloc.IMemBuffer16::GetPointer(szPrim * 2);	// primitive: start, num_elements
-	int32_t* prim32 = tsalloc.IMemBuffer32::GetPointer(szPrim);		// primitive: mat_index
-	szInd = tsalloc.IMemBuffer32::Get();
+	szPrim = alloc.IMemBuffer32::Get();
+	int16_t* prim16 = alloc.IMemBuffer16::GetPointer(szPrim * 2);	// primitive: start, num_elements
+	int32_t* prim32 = alloc.IMemBuffer32::GetPointer(szPrim);		// primitive: mat_index
+	szInd = alloc.IMemBuffer32::Get();
 
-	int16_t* ind16 = tsalloc.IMemBuffer16::GetPointer(szInd);
+	int16_t* ind16 = alloc.IMemBuffer16::GetPointer(szInd);
 
 	// need to copy to temporary arrays
 	prim = new TSDrawPrimitive[szPrim];
@@ -539,82 +917,120 @@ void TSMesh::Assemble(bool skip)
 	delete[] prim;
 	delete[] ind;
 
-	int32_t sz = tsalloc.IMemBuffer32::Get();
-	tsalloc.IMemBuffer16::GetPointer(sz); // skip deprecated merge indices
-	tsalloc.Align32();
+	int32_t sz = alloc.IMemBuffer32::Get();
+	alloc.IMemBuffer16::GetPointer(sz); // skip deprecated merge indices
 
-	verts_per_frame_ = tsalloc.IMemBuffer32::Get();
-	uint32_t flags = (uint32_t)tsalloc.IMemBuffer32::Get();
+	verts_per_frame_ = alloc.IMemBuffer32::Get();
+	uint32_t flags = (uint32_t)alloc.IMemBuffer32::Get();
 
 	SetFlags(flags);
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 }
 
-void TSMesh::Disassemble()
+void TSMesh::Disassemble(OTSShapeAlloc& alloc)
 {
-	tsalloc.SetGuard();
+	alloc.SetGuard();
 
-	tsalloc.OMemBuffer32::Set(num_frames_);
-	tsalloc.OMemBuffer32::Set(num_mat_frames_);
-	tsalloc.OMemBuffer32::Set(parent_mesh_);
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(&bounds_), 6);
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(&center_), 3);
-	tsalloc.OMemBuffer32::Set(static_cast<int32_t>(radius_));
+	alloc.OMemBuffer32::Set(num_frames_);
+	alloc.OMemBuffer32::Set(num_mat_frames_);
+	alloc.OMemBuffer32::Set(parent_mesh_);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(&bounds_), 6);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(&center_), 3);
+	alloc.OMemBuffer32::Set(static_cast<int32_t>(radius_));
 
 	// verts...
-	tsalloc.OMemBuffer32::Set(verts_.size());
+	alloc.OMemBuffer32::Set(verts_.size());
 	if (parent_mesh_ < 0)
-		tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(verts_)), 3 * verts_.size()); // if no parent mesh, then save off our verts
+		alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(verts_)), 3 * verts_.size()); // if no parent mesh, then save off our verts
 
 	// tverts...
-	tsalloc.OMemBuffer32::Set(tverts_.size());
+	alloc.OMemBuffer32::Set(tverts_.size());
 	if (parent_mesh_ < 0)
-		tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(tverts_)), 2 * tverts_.size()); // if no parent mesh, then save off our verts
+		alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(tverts_)), 2 * tverts_.size()); // if no parent mesh, then save off our verts
 
 	// norms...
 	if (parent_mesh_ < 0) // if no parent mesh, then save off our norms
-		tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(norms_)), 3 * norms_.size());  // norms.size()==verts.size() or error...
+		alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(norms_)), 3 * norms_.size());  // norms.size()==verts.size() or error...
 
 	// encoded norms...
 	if (parent_mesh_ < 0)
-	{
-		// if no parent mesh, compute encoded normals and copy over
-		for (int32_t i = 0; i < norms_.size(); i++)
-		{
-			uint8_t norm_idx = encoded_norms_.size() ? encoded_norms_[i] : EncodeNormal(norms_[i]);
-			tsalloc.OMemBuffer8::CopyToBuffer(reinterpret_cast<int8_t*>(&norm_idx), 1);
-		}
-	}
+		WriteEncodedNormals(alloc); // if no parent mesh, compute encoded normals and copy over
 
 	// primitives
-	tsalloc.OMemBuffer32::Set(primitives_.size());
+	alloc.OMemBuffer32::Set(primitives_.size());
 	for (int32_t i = 0; i < primitives_.size(); i++)
 	{
 		int16_t start = static_cast<int16_t>(primitives_[i].start);
 		int16_t num_elements = static_cast<int16_t>(primitives_[i].num_elements);
 
-		tsalloc.OMemBuffer16::CopyToBuffer(&start, 1);
-		tsalloc.OMemBuffer16::CopyToBuffer(&num_elements, 1);
-		tsalloc.OMemBuffer32::CopyToBuffer(&(primitives_[i].mat_index), 1);
+		alloc.OMemBuffer16::CopyToBuffer(&start, 1);
+		alloc.OMemBuffer16::CopyToBuffer(&num_elements, 1);
+		alloc.OMemBuffer32::CopyToBuffer(&(primitives_[i].mat_index), 1);
 	}
 
 	// indices
-	tsalloc.OMemBuffer32::Set(indices_.size());
-	std::vector<int16_t> s16_indices;
-	s16_indices.reserve(indices_.size());
+	alloc.OMemBuffer32::Set(indices_.size());
 	for (int32_t i = 0; i < indices_.size(); i++)
-		s16_indices.push_back(static_cast<int16_t>(indices_[i]));
-	tsalloc.OMemBuffer16::CopyToBuffer(reinterpret_cast<int16_t*>(Vector::Address(s16_indices)), s16_indices.size());
+		alloc.OMemBuffer16::Set(static_cast<int16_t>(indices_[i]));
 
 	// merge indices...DEPRECATED
-	tsalloc.OMemBuffer32::Set(0);
+	alloc.OMemBuffer32::Set(0);
 
 	// small stuff...
-	tsalloc.OMemBuffer32::Set(verts_per_frame_);
-	tsalloc.OMemBuffer32::Set(GetFlags());
+	alloc.OMemBuffer32::Set(verts_per_frame_);
+	alloc.OMemBuffer32::Set(GetFlags());
+
+	alloc.SetGuard();
+}
+
+void TSMesh::SetDirty()
+{
+	write_cache_.reset();
+}
+
+void TSMesh::SetWriteCache(std::unique_ptr<OTSShapeAlloc> fragment)
+{
+	write_cache_ = std::move(fragment);
+}
+
+void TSMesh::UpdateWriteCache()
+{
+	if (write_cache_)
+		return;
 
-	tsalloc.SetGuard();
+	write_cache_.reset(new OTSShapeAlloc);
+	write_cache_->SetWrite();
+	DisassembleFragment(*write_cache_);
+}
+
+void TSMesh::DisassembleFragment(OTSShapeAlloc& fragment)
+{
+	int32_t size32 = fragment.OMemBuffer32::GetBufferSize();
+	int32_t size16 = fragment.OMemBuffer16::GetBufferSize();
+	int32_t size8 = fragment.OMemBuffer8::GetBufferSize();
+	AddWriteSize(&size32, &size16, &size8);
+
+	// one allocation per buffer, as long as AddWriteSize keeps up with Disassemble
+	fragment.Reserve(size32, size16, size8);
+	Disassemble(fragment);
+	assert(fragment.OMemBuffer32::GetBufferSize() == size32);
+	assert(fragment.OMemBuffer16::GetBufferSize() == size16);
+	assert(fragment.OMemBuffer8::GetBufferSize() == size8);
+}
+
+void TSMesh::AddWriteSize(int32_t* size32, int32_t* size16, int32_t* size8) const
+{
+	// two guards, the header and the per-array counts
+	*size32 += 2 + 13 + 7 + primitives_.size();
+	*size16 += 2 + 2 * primitives_.size() + indices_.size();
+	*size8 += 2;
+
+	if (parent_mesh_ < 0)
+	{
+		*size32 += 3 * verts_.size() + 2 * tverts_.size() + 3 * norms_.size();
+		*size8 += norms_.size();
+	}
 }
 
 void TSMesh::CopySourceVertexDataFrom(const TSMesh* src_mesh)
@@ -622,6 +1038,7 @@ void TSMesh::CopySourceVertexDataFrom(const TSMesh* src_mesh)
 	verts_ = src_mesh->verts_;
 	tverts_ = src_mesh->tverts_;
 	norms_ = src_mesh->norms_;
+	SetDirty();
 }
 
 void TSSkinMesh::CopySourceVertexDataFrom(const TSMesh* src_mesh)
@@ -643,94 +1060,140 @@ TSSkinMesh::TSSkinMesh()
 	mesh_type_ = kSkinMeshType;
 }
 
-void TSSkinMesh::Assemble(bool skip)
+void TSSkinMesh::Skip(ITSShapeAlloc& alloc, int32_t mesh_index)
 {
-	TSMesh::Assemble(skip);
+	int32_t parent_mesh = TSMesh::Skip(alloc, mesh_index);
+
+	int32_t num_verts = alloc.IMemBuffer32::Get();
+	SkipSharedData<int32_t>(alloc, parent_mesh, 3 * num_verts, alloc.verts_list_, mesh_index);
 
-	int32_t sz = tsalloc.IMemBuffer32::Get();
+	if (alloc.GetReadVersion() > 21)
+	{
+		SkipSharedData<int32_t>(alloc, parent_mesh, 3 * num_verts, alloc.norms_list_, mesh_index);
+		SkipSharedData<int8_t>(alloc, parent_mesh, num_verts, alloc.encoded_norms_list_, mesh_index);
+	}
+	else
+	{
+		// no encoded normals...
+		alloc.norms_list_[mesh_index] = reinterpret_cast<Point3F*>(alloc.IMemBuffer32::GetPointer(3 * num_verts));
+		alloc.encoded_norms_list_[mesh_index] = nullptr;
+	}
+
+	int32_t sz = alloc.IMemBuffer32::Get();
+	SkipSharedData<int32_t>(alloc, parent_mesh, 16 * sz, alloc.init_transform_list_, mesh_index);
+
+	sz = alloc.IMemBuffer32::Get();
+	SkipSharedData<int32_t>(alloc, parent_mesh, sz, alloc.vertex_index_list_, mesh_index);
+	SkipSharedData<int32_t>(alloc, parent_mesh, sz, alloc.bone_index_list_, mesh_index);
+	SkipSharedData<int32_t>(alloc, parent_mesh, sz, alloc.weight_list_, mesh_index);
+
+	sz = alloc.IMemBuffer32::Get();
+	SkipSharedData<int32_t>(alloc, parent_mesh, sz, alloc.node_index_list_, mesh_index);
+
+	alloc.CheckGuard();
+}
+
+void TSSkinMesh::Assemble(ITSShapeAlloc& alloc)
+{
+	TSMesh::Assemble(alloc);
+
+	int32_t sz = alloc.IMemBuffer32::Get();
 	int32_t num_verts = sz;
-	int32_t* ptr32 = GetSharedData<int32_t>(parent_mesh_, 3 * num_verts, reinterpret_cast<int32_t**>(Vector::Address(verts_list_)), skip);
+	int32_t* ptr32 = GetSharedData<int32_t>(alloc, parent_mesh_, 3 * num_verts, reinterpret_cast<int32_t**>(Vector::Address(alloc.verts_list_)));
 	Vector::Set(initial_verts_, ptr32, sz);
 
 	int8_t* ptr8;
-	if (TSShape::current_read_version_ > 21)
+	if (alloc.GetReadVersion() > 21)
 	{
-		ptr32 = GetSharedData<int32_t>(parent_mesh_, 3 * num_verts, reinterpret_cast<int32_t**>(Vector::Address(norms_list_)), skip);
+		ptr32 = GetSharedData<int32_t>(alloc, parent_mesh_, 3 * num_verts, reinterpret_cast<int32_t**>(Vector::Address(alloc.norms_list_)));
 		Vector::Set(initial_norms_, ptr32, num_verts);
 
-		ptr8 = GetSharedData<int8_t>(parent_mesh_, num_verts, reinterpret_cast<int8_t**>(Vector::Address(encoded_norms_list_)), skip);
+		ptr8 = GetSharedData<int8_t>(alloc, parent_mesh_, num_verts, reinterpret_cast<int8_t**>(Vector::Address(alloc.encoded_norms_list_)));
 		Vector::Set(encoded_norms_, ptr8, num_verts);
 	}
 	else
 	{
 		// no encoded normals...
-		ptr32 = tsalloc.IMemBuffer32::CopyToShape(3 * num_verts);
+		ptr32 = alloc.IMemBuffer32::GetPointer(3 * num_verts);
 		Vector::Set(initial_norms_, ptr32, num_verts);
 		Vector::Set(encoded_norms_, nullptr, 0);
 	}
 
-	sz = tsalloc.IMemBuffer32::Get();
-	ptr32 = GetSharedData<int32_t>(parent_mesh_, 16 * sz, reinterpret_cast<int32_t**>(Vector::Address(init_transform_list_)), skip);
+	sz = alloc.IMemBuffer32::Get();
+	ptr32 = GetSharedData<int32_t>(alloc, parent_mesh_, 16 * sz, reinterpret_cast<int32_t**>(Vector::Address(alloc.init_transform_list_)));
 	Vector::Set(initial_transforms_, ptr32, sz);
 
-	sz = tsalloc.IMemBuffer32::Get();
-	ptr32 = GetSharedData<int32_t>(parent_mesh_, sz, reinterpret_cast<int32_t**>(Vector::Address(vertex_index_list_)), skip);
+	sz = alloc.IMemBuffer32::Get();
+	ptr32 = GetSharedData<int32_t>(alloc, parent_mesh_, sz, reinterpret_cast<int32_t**>(Vector::Address(alloc.vertex_index_list_)));
 	Vector::Set(vertex_index_, ptr32, sz);
 
-	ptr32 = GetSharedData<int32_t>(parent_mesh_, sz, reinterpret_cast<int32_t**>(Vector::Address(bone_index_list_)), skip);
+	ptr32 = GetSharedData<int32_t>(alloc, parent_mesh_, sz, reinterpret_cast<int32_t**>(Vector::Address(alloc.bone_index_list_)));
 	Vector::Set(bone_index_, ptr32, sz);
 
-	ptr32 = GetSharedData<int32_t>(parent_mesh_, sz, reinterpret_cast<int32_t**>(Vector::Address(weight_list_)), skip);
+	ptr32 = GetSharedData<int32_t>(alloc, parent_mesh_, sz, reinterpret_cast<int32_t**>(Vector::Address(alloc.weight_list_)));
 	Vector::Set(weight_, ptr32, sz);
 
-	sz = tsalloc.IMemBuffer32::Get();
-	ptr32 = GetSharedData<int32_t>(parent_mesh_, sz, reinterpret_cast<int32_t**>(Vector::Address(node_index_list_)), skip);
+	sz = alloc.IMemBuffer32::Get();
+	ptr32 = GetSharedData<int32_t>(alloc, parent_mesh_, sz, reinterpret_cast<int32_t**>(Vector::Address(alloc.node_index_list_)));
 	Vector::Set(node_index_, ptr32, sz);
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 }
 
-void TSSkinMesh::Disassemble()
+void TSSkinMesh::Disassemble(OTSShapeAlloc& alloc)
 {
-	TSMesh::Disassemble();
+	TSMesh::Disassemble(alloc);
 
-	tsalloc.OMemBuffer32::Set(initial_verts_.size());
+	alloc.OMemBuffer32::Set(initial_verts_.size());
 	// if we have no parent mesh, then save off our verts & norms
 	if (parent_mesh_ < 0)
 	{
-		tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(verts_)), 3 * verts_.size());
+		alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(verts_)), 3 * verts_.size());
 
 		// no longer do this here...let tsmesh handle this
-		tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(norms_)), 3 * norms_.size());
+		alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(norms_)), 3 * norms_.size());
 
 		// if no parent mesh, compute encoded normals and copy over
-		for (int32_t i = 0; i < norms_.size(); i++)
-		{
-			uint8_t norm_idx = encoded_norms_.size() ? encoded_norms_[i] : EncodeNormal(norms_[i]);
-			tsalloc.OMemBuffer8::CopyToBuffer(reinterpret_cast<int8_t*>(&norm_idx), 1);
-		}
+		WriteEncodedNormals(alloc);
 	}
 
-	tsalloc.OMemBuffer32::Set(initial_transforms_.size());
+	alloc.OMemBuffer32::Set(initial_transforms_.size());
 	if (parent_mesh_ < 0)
-		tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(initial_transforms_)), initial_transforms_.size() * 16);
+		alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(initial_transforms_)), initial_transforms_.size() * 16);
 
 
-	tsalloc.OMemBuffer32::Set(vertex_index_.size());
+	alloc.OMemBuffer32::Set(vertex_index_.size());
 	if (parent_mesh_ < 0)
 	{
-		tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(vertex_index_)), vertex_index_.size());
+		alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(vertex_index_)), vertex_index_.size());
 
-		tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(bone_index_)), bone_index_.size());
+		alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(bone_index_)), bone_index_.size());
 
-		tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(weight_)), weight_.size());
+		alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(weight_)), weight_.size());
 	}
 
-	tsalloc.OMemBuffer32::Set(node_index_.size());
+	alloc.OMemBuffer32::Set(node_index_.size());
 	if (parent_mesh_ < 0)
-		tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(node_index_)), node_index_.size());
+		alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(node_index_)), node_index_.size());
 
-	tsalloc.SetGuard();
+	alloc.SetGuard();
+}
+
+void TSSkinMesh::AddWriteSize(int32_t* size32, int32_t* size16, int32_t* size8) const
+{
+	TSMesh::AddWriteSize(size32, size16, size8);
+
+	// four counts and a guard
+	*size32 += 5;
+	*size16 += 1;
+	*size8 += 1;
+
+	if (parent_mesh_ < 0)
+	{
+		*size32 += 3 * verts_.size() + 3 * norms_.size() + 16 * initial_transforms_.size();
+		*size32 += vertex_index_.size() + bone_index_.size() + weight_.size() + node_index_.size();
+		*size8 += norms_.size();
+	}
 }
 
 } // namespace DTS
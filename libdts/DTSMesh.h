@@ -1,7 +1,10 @@
 #ifndef DTS_MESH_H_
 #define DTS_MESH_H_
 
+#include <memory>
+
 #include "DTSMath.h"
+#include "DTSShapeAlloc.h"
 #include "DTSVector.h"
 
 namespace DTS
@@ -51,7 +54,7 @@ public:
 	virtual ~TSMesh() {}
 
 	uint32_t GetMeshType() const { return mesh_type_ & kTypeMask; }
-	void SetFlags(uint32_t flag) { mesh_type_ |= flag; }
+	void SetFlags(uint32_t flag) { mesh_type_ |= flag; SetDirty(); }
 	uint32_t GetFlags(uint32_t flag = 0xFFFFFFFF) const { return mesh_type_ & flag; }
 
 	virtual void CopySourceVertexDataFrom(const TSMesh* src_mesh);
@@ -65,37 +68,54 @@ public:
 	float GetRadius() const { return radius_; }
 
 	static uint8_t EncodeNormal(const Point3F& normal);
+	static void EncodeNormals(const Point3F* normals, uint8_t* encoded, int32_t count);
 	static const Point3F& DecodeNormal(uint8_t ncode) { return kU8ToNormalTable[ncode]; }
 
 	// persist methods...
-	virtual void Assemble(bool skip);
-	static TSMesh* TSMesh::AssembleMesh(uint32_t mesh_type, bool skip);
-	virtual void Disassemble();
+	virtual void Assemble(ITSShapeAlloc& alloc);
+	static TSMesh* AssembleMesh(ITSShapeAlloc& alloc, uint32_t mesh_type, bool skip);
+	virtual void Disassemble(OTSShapeAlloc& alloc);
+	virtual void AddWriteSize(int32_t* size32, int32_t* size16, int32_t* size8) const; // adds what Disassemble writes to each buffer
+	void DisassembleFragment(OTSShapeAlloc& fragment); // Disassemble, with fragment sized by AddWriteSize first
+
+	// Moves the read position past a mesh without assembling it.  Where the
+	// mesh's data sits in the read buffers is still recorded under mesh_index,
+	// so meshes that share it can be assembled.
+	static void SkipMesh(ITSShapeAlloc& alloc, uint32_t mesh_type, int32_t mesh_index);
+	static int32_t Skip(ITSShapeAlloc& alloc, int32_t mesh_index); // returns the skipped mesh's parent
+
+	// The mesh as it was last loaded or saved, kept when the shape caches
+	// writes so that an unchanged mesh is written again without being
+	// disassembled.  The methods that change what is written drop it; anything
+	// editing the mesh's data directly has to call SetDirty() itself.
+	bool IsDirty() const { return !write_cache_; }
+	void SetDirty();
+	const OTSShapeAlloc* GetWriteCache() const { return write_cache_.get(); }
+	void SetWriteCache(std::unique_ptr<OTSShapeAlloc> fragment);
+	void UpdateWriteCache(); // disassembles the mesh into its cache if dirty
+
+	// Room an assembled mesh takes up in the shape (the largest mesh type)
+	static int32_t GetMaxMeshSize();
 
 	// methods used during assembly to share vertex and other info
 	// between meshes (and for skipping detail levels on load)
 	template<typename T>
-	T* GetSharedData(int32_t parent_mesh, int32_t size, T** source, bool skip)
+	T* GetSharedData(ITSShapeAlloc& alloc, int32_t parent_mesh, int32_t size, T** source)
 	{
-		#define tsalloc TSShape::alloc_
-		T* ptr;
-		if (parent_mesh < 0)
-			ptr = skip ? tsalloc.IMemBuffer<T>::GetPointer(size) : tsalloc.IMemBuffer<T>::CopyToShape(size);
+		// meshes with a parent copy its data from wherever the parent was assembled
+		if (parent_mesh >= 0)
+			return source[parent_mesh];
+
+		return alloc.IMemBuffer<T>::GetPointer(size);
+	}
+
+	template<typename T, typename U>
+	static void SkipSharedData(ITSShapeAlloc& alloc, int32_t parent_mesh, int32_t size, std::vector<U*>& list, int32_t mesh_index)
+	{
+		if (parent_mesh >= 0)
+			list[mesh_index] = list[parent_mesh];
 		else
-		{
-			ptr = source[parent_mesh];
-			// if we skipped the previous mesh (and we're not skipping this one) then
-			// we still need to copy points into the shape...
-			if (!data_copied_[parent_mesh] && !skip)
-			{
-				T* tmp = ptr;
-				ptr = tsalloc.IMemBuffer<T>::AllocShape(size);
-				if (ptr && tmp)
-					memcpy(ptr, tmp, size * sizeof(int32_t));
-			}
-		}
-		return ptr;
-		#undef tsalloc
+			list[mesh_index] = reinterpret_cast<U*>(alloc.IMemBuffer<T>::GetPointer(size));
 	}
 
 	int32_t parent_mesh_; // index into shapes mesh list
@@ -112,21 +132,29 @@ public:
 	std::vector<uint8_t> encoded_norms_;
 	std::vector<uint32_t> indices_;
 
-	// Assembly Variables
-	static std::vector<Point3F*>	verts_list_;
-	static std::vector<Point3F*>	norms_list_;
-	static std::vector<uint8_t*>	encoded_norms_list_;
-	static std::vector<Point2F*>	tverts_list_;
-
-	static std::vector<bool>		data_copied_;
-
 protected:
+	void WriteEncodedNormals(OTSShapeAlloc& alloc) const;
+
+	std::unique_ptr<OTSShapeAlloc> write_cache_;
 	uint32_t mesh_type_;
 	Box3F bounds_;
 	Point3F center_;
 	float radius_;
 };
 
+// Skin weights packed a vertex at a time, so skinning is one streaming pass
+// over the vertices.  Each vertex has influences slots of bone and weight,
+// heaviest first, and unused slots have weight 0.  A vertex's weights add up
+// to kWeightScale.
+struct TSSkinPack
+{
+	static const int32_t kWeightScale = 255;
+
+	int32_t influences;
+	std::vector<uint16_t> bones;
+	std::vector<uint8_t> weights;
+};
+
 class TSSkinMesh : public TSMesh
 {
 public:
@@ -135,8 +163,38 @@ public:
 	virtual void CopySourceVertexDataFrom(const TSMesh* src_mesh);
 
 	// persist methods...
-	void Assemble(bool skip);
-	void Disassemble();
+	void Assemble(ITSShapeAlloc& alloc);
+	void Disassemble(OTSShapeAlloc& alloc);
+	void AddWriteSize(int32_t* size32, int32_t* size16, int32_t* size8) const;
+	static void Skip(ITSShapeAlloc& alloc, int32_t mesh_index);
+
+	// Skinning
+
+	// bones[i] = node_transforms[node_index_[i]] * initial_transforms_[i],
+	// given every node's world transform
+	void GetBoneTransforms(const MatrixF* node_transforms, std::vector<MatrixF>* bones) const;
+
+	// Writes initial_verts_ and initial_norms_, deformed by bones (one per
+	// node_index_ entry), to verts and norms; norms may be nullptr.  Each has
+	// room for initial_verts_.size().  threads > 1 splits big meshes between
+	// that many threads, 0 uses one per core; the tuples have to be in vertex
+	// order for that, as exporters write them, or one thread is used.  The
+	// threads are started and joined on every call, so when skinning every
+	// frame, spread the meshes over threads of your own with threads = 1.
+	void Skin(const MatrixF* bones, Point3F* verts, Point3F* norms, int32_t threads = 1) const;
+
+	// Packs the tuples a vertex at a time, keeping each vertex's heaviest
+	// max_influences (4 or 8) that weigh at least min_weight of it, or else
+	// just its heaviest.  What is kept is renormalized and quantized.
+	// Returns false, leaving pack alone, if a tuple is out of range.
+	bool PackInfluences(int32_t max_influences, float min_weight, TSSkinPack* pack) const;
+
+	// Replaces the tuples with pack's, in vertex order.  Returns false,
+	// leaving them alone, if pack isn't one this mesh could have packed.
+	bool SetInfluences(const TSSkinPack& pack);
+
+	// As above, from packed weights; any mesh can be split between threads
+	void Skin(const TSSkinPack& pack, const MatrixF* bones, Point3F* verts, Point3F* norms, int32_t threads = 1) const;
 
 	// vectors that define the vertex, weight, bone tuples
 	std::vector<float> weight_;
@@ -153,14 +211,6 @@ public:
 	// pos, and then weighted by bone weights...
 	std::vector<Point3F> initial_verts_;
 	std::vector<Point3F> initial_norms_;
-
-	// variables used during assembly (for skipping mesh detail levels
-	// on load and for sharing verts between meshes)
-	static std::vector<MatrixF*>	init_transform_list_;
-	static std::vector<int32_t*>	vertex_index_list_;
-	static std::vector<int32_t*>	bone_index_list_;
-	static std::vector<float*>		weight_list_;
-	static std::vector<int32_t*>	node_index_list_;
 };
 
 } // namespace DTS
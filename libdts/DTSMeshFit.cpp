@@ -82,7 +82,7 @@ void MeshFit::InitSourceGeometry(const std::string& target)
 		const TSShape::Object &obj = shape_->objects_[obj_index];
 		for (int32_t i = 0; i < obj.num_meshes; i++)
 		{
-			const TSMesh* mesh = shape_->meshes_[obj.start_mesh_index + i];
+			const TSMesh* mesh = shape_->GetMesh(obj.start_mesh_index + i);
 			if (mesh)
 			{
 				AddSourceMesh(obj, mesh);
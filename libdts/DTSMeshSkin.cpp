@@ -0,0 +1,408 @@
+#include "DTSMesh.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+#include "DTSSimd.h"
+
+namespace DTS
+{
+
+namespace
+{
+
+// Not worth a thread for fewer
+const int32_t kMinThreadVerts = 8192;
+
+#if defined(DTS_SSE2)
+
+// The bones' columns, 4 floats each, so a point is transformed with three
+// multiply-adds
+typedef std::vector<float> BonePalette;
+
+void SetPalette(const MatrixF* bones, int32_t num_bones, BonePalette* palette)
+{
+	palette->resize(16 * num_bones);
+	for (int32_t i = 0; i < num_bones; i++)
+	{
+		const float* m = bones[i];
+		float* columns = &(*palette)[16 * i];
+		for (int32_t c = 0; c < 4; c++)
+			for (int32_t r = 0; r < 4; r++)
+				columns[4 * c + r] = m[4 * r + c];
+	}
+}
+
+// x and y go through __m64, which may alias floats
+inline __m128 Load3(const Point3F& p)
+{
+	__m128 xy = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(&p.x));
+	return _mm_movelh_ps(xy, _mm_load_ss(&p.z));
+}
+
+inline void Store3(Point3F* p, __m128 v)
+{
+	_mm_storel_pi(reinterpret_cast<__m64*>(&p->x), v);
+	_mm_store_ss(&p->z, _mm_movehl_ps(v, v));
+}
+
+inline __m128 MulV(const __m128 columns[4], const Point3F& v)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(columns[0], _mm_set1_ps(v.x)), _mm_mul_ps(columns[1], _mm_set1_ps(v.y))),
+		_mm_mul_ps(columns[2], _mm_set1_ps(v.z)));
+}
+
+inline __m128 MulP(const __m128 columns[4], const Point3F& p)
+{
+	return _mm_add_ps(MulV(columns, p), columns[3]);
+}
+
+#else
+
+typedef const MatrixF* BonePalette;
+
+void SetPalette(const MatrixF* bones, int32_t, BonePalette* palette)
+{
+	*palette = bones;
+}
+
+#endif
+
+// Skins the vertices from first_vert up to end_vert, whose tuples are the
+// ones from first_tuple up to end_tuple
+void SkinRange(const TSSkinMesh& mesh, const BonePalette& palette, int32_t first_vert, int32_t end_vert,
+	int32_t first_tuple, int32_t end_tuple, Point3F* verts, Point3F* norms)
+{
+	int32_t i;
+	std::fill(verts + first_vert, verts + end_vert, Point3F::kZero);
+	if (norms)
+		std::fill(norms + first_vert, norms + end_vert, Point3F::kZero);
+
+	// each tuple adds its bone's share to its vertex
+	for (i = first_tuple; i < end_tuple; i++)
+	{
+		int32_t vert = mesh.vertex_index_[i];
+		int32_t bone = mesh.bone_index_[i];
+		float weight = mesh.weight_[i];
+
+#if defined(DTS_SSE2)
+		const float* bone_columns = &palette[16 * bone];
+		__m128 w = _mm_set1_ps(weight);
+		__m128 columns[4];
+		for (int32_t c = 0; c < 4; c++)
+			columns[c] = _mm_loadu_ps(bone_columns + 4 * c);
+
+		__m128 v = MulP(columns, mesh.initial_verts_[vert]);
+		Store3(&verts[vert], _mm_add_ps(Load3(verts[vert]), _mm_mul_ps(v, w)));
+
+		if (norms)
+		{
+			v = MulV(columns, mesh.initial_norms_[vert]);
+			Store3(&norms[vert], _mm_add_ps(Load3(norms[vert]), _mm_mul_ps(v, w)));
+		}
+#else
+		Point3F v;
+		palette[bone].MulP(mesh.initial_verts_[vert], &v);
+		verts[vert] += v * weight;
+
+		if (norms)
+		{
+			palette[bone].MulV(mesh.initial_norms_[vert], &v);
+			norms[vert] += v * weight;
+		}
+#endif
+	}
+
+	if (norms)
+	{
+		for (i = first_vert; i < end_vert; i++)
+			norms[i].Normalize();
+	}
+}
+
+// Skins the vertices from first_vert up to end_vert, blending each one's
+// bones into a single transform
+void SkinPackedRange(const TSSkinMesh& mesh, const TSSkinPack& pack, const BonePalette& palette,
+	int32_t first_vert, int32_t end_vert, Point3F* verts, Point3F* norms)
+{
+	const float to_weight = 1.0f / TSSkinPack::kWeightScale;
+	const int32_t influences = pack.influences;
+	int32_t i, j;
+	for (i = first_vert; i < end_vert; i++)
+	{
+		const uint16_t* bones = &pack.bones[i * influences];
+		const uint8_t* weights = &pack.weights[i * influences];
+
+#if defined(DTS_SSE2)
+		__m128 columns[4];
+		for (int32_t c = 0; c < 4; c++)
+			columns[c] = _mm_setzero_ps();
+
+		// slots are heaviest first, so the first empty one ends them
+		for (j = 0; j < influences && weights[j]; j++)
+		{
+			const float* bone_columns = &palette[16 * bones[j]];
+			__m128 w = _mm_set1_ps(weights[j] * to_weight);
+			for (int32_t c = 0; c < 4; c++)
+				columns[c] = _mm_add_ps(columns[c], _mm_mul_ps(_mm_loadu_ps(bone_columns + 4 * c), w));
+		}
+
+		Store3(&verts[i], MulP(columns, mesh.initial_verts_[i]));
+		if (norms)
+		{
+			Store3(&norms[i], MulV(columns, mesh.initial_norms_[i]));
+			norms[i].Normalize();
+		}
+#else
+		verts[i] = Point3F::kZero;
+		if (norms)
+			norms[i] = Point3F::kZero;
+
+		for (j = 0; j < influences && weights[j]; j++)
+		{
+			float weight = weights[j] * to_weight;
+			Point3F v;
+			palette[bones[j]].MulP(mesh.initial_verts_[i], &v);
+			verts[i] += v * weight;
+
+			if (norms)
+			{
+				palette[bones[j]].MulV(mesh.initial_norms_[i], &v);
+				norms[i] += v * weight;
+			}
+		}
+
+		if (norms)
+			norms[i].Normalize();
+#endif
+	}
+}
+
+// Calls skin(first_vert, end_vert) for an even share of the vertices on
+// each of threads threads, the last share on this one
+void SplitVerts(int32_t num_verts, int32_t threads, const std::function<void(int32_t, int32_t)>& skin)
+{
+	std::vector<std::thread> workers;
+	int32_t first_vert = 0;
+	for (int32_t t = 1; t <= threads; t++)
+	{
+		int32_t end_vert = static_cast<int32_t>(static_cast<int64_t>(num_verts) * t / threads);
+		if (t < threads)
+			workers.emplace_back(skin, first_vert, end_vert);
+		else
+			skin(first_vert, end_vert);
+		first_vert = end_vert;
+	}
+
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+int32_t NumThreads(int32_t threads, int32_t num_verts)
+{
+	if (threads <= 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	return std::max(1, std::min(threads, num_verts / kMinThreadVerts));
+}
+
+// A vertex's influence while packing
+struct Influence
+{
+	int32_t bone;
+	float weight;
+
+	bool operator<(const Influence& other) const { return weight > other.weight; } // heaviest first
+};
+
+} // namespace
+
+void TSSkinMesh::GetBoneTransforms(const MatrixF* node_transforms, std::vector<MatrixF>* bones) const
+{
+	int32_t num_bones = static_cast<int32_t>(node_index_.size());
+	bones->resize(num_bones);
+	for (int32_t i = 0; i < num_bones; i++)
+		(*bones)[i].Mul(node_transforms[node_index_[i]], initial_transforms_[i]);
+}
+
+void TSSkinMesh::Skin(const MatrixF* bones, Point3F* verts, Point3F* norms, int32_t threads) const
+{
+	const int32_t num_verts = static_cast<int32_t>(initial_verts_.size());
+	const int32_t num_tuples = static_cast<int32_t>(vertex_index_.size());
+
+	threads = NumThreads(threads, num_verts);
+	if (threads > 1 && !std::is_sorted(vertex_index_.begin(), vertex_index_.end()))
+		threads = 1;
+
+	BonePalette palette;
+	SetPalette(bones, static_cast<int32_t>(node_index_.size()), &palette);
+
+	if (threads == 1)
+	{
+		SkinRange(*this, palette, 0, num_verts, 0, num_tuples, verts, norms);
+		return;
+	}
+
+	// each share of the vertices along with their tuples
+	SplitVerts(num_verts, threads, [&](int32_t first_vert, int32_t end_vert)
+	{
+		int32_t first_tuple = static_cast<int32_t>(std::lower_bound(vertex_index_.begin(), vertex_index_.end(), first_vert) - vertex_index_.begin());
+		int32_t end_tuple = static_cast<int32_t>(std::lower_bound(vertex_index_.begin() + first_tuple, vertex_index_.end(), end_vert) - vertex_index_.begin());
+		SkinRange(*this, palette, first_vert, end_vert, first_tuple, end_tuple, verts, norms);
+	});
+}
+
+bool TSSkinMesh::PackInfluences(int32_t max_influences, float min_weight, TSSkinPack* pack) const
+{
+	if (max_influences != 4 && max_influences != 8)
+		return false;
+
+	const int32_t num_verts = static_cast<int32_t>(initial_verts_.size());
+	const int32_t num_bones = std::min(static_cast<int32_t>(node_index_.size()), 0x10000);
+	const int32_t num_tuples = static_cast<int32_t>(vertex_index_.size());
+	int32_t i, j;
+
+	if (static_cast<int32_t>(bone_index_.size()) != num_tuples || static_cast<int32_t>(weight_.size()) != num_tuples)
+		return false;
+	for (i = 0; i < num_tuples; i++)
+	{
+		if (vertex_index_[i] < 0 || vertex_index_[i] >= num_verts || bone_index_[i] < 0 || bone_index_[i] >= num_bones)
+			return false;
+	}
+
+	// group the tuples by vertex
+	std::vector<int32_t> first(num_verts + 1, 0);
+	for (i = 0; i < num_tuples; i++)
+		first[vertex_index_[i] + 1]++;
+	for (i = 0; i < num_verts; i++)
+		first[i + 1] += first[i];
+
+	std::vector<int32_t> order(num_tuples);
+	std::vector<int32_t> next(first.begin(), first.end() - 1);
+	for (i = 0; i < num_tuples; i++)
+		order[next[vertex_index_[i]]++] = i;
+
+	pack->influences = max_influences;
+	pack->bones.assign(num_verts * max_influences, 0);
+	pack->weights.assign(num_verts * max_influences, 0);
+
+	std::vector<Influence> influences;
+	std::vector<float> remainders;
+	for (i = 0; i < num_verts; i++)
+	{
+		// one influence per bone, heaviest first
+		influences.clear();
+		float total = 0.0f;
+		for (j = first[i]; j < first[i + 1]; j++)
+		{
+			int32_t bone = bone_index_[order[j]];
+			float weight = weight_[order[j]];
+			total += weight;
+
+			std::vector<Influence>::iterator it = std::find_if(influences.begin(), influences.end(),
+				[bone](const Influence& influence) { return influence.bone == bone; });
+			if (it != influences.end())
+				it->weight += weight;
+			else
+				influences.push_back({ bone, weight });
+		}
+		std::stable_sort(influences.begin(), influences.end());
+
+		// keep the heaviest, and the rest that aren't too light
+		int32_t kept = 0;
+		float kept_total = 0.0f;
+		for (const Influence& influence : influences)
+		{
+			if (kept == max_influences || (kept && influence.weight < min_weight * total))
+				break;
+			kept_total += influence.weight;
+			kept++;
+		}
+		if (kept_total <= 0.0f)
+			continue;
+
+		// round down, then give what that leaves out to the biggest remainders
+		uint16_t* bones = &pack->bones[i * max_influences];
+		uint8_t* weights = &pack->weights[i * max_influences];
+		remainders.resize(kept);
+		int32_t left = TSSkinPack::kWeightScale;
+		for (j = 0; j < kept; j++)
+		{
+			float scaled = influences[j].weight / kept_total * TSSkinPack::kWeightScale;
+			bones[j] = static_cast<uint16_t>(influences[j].bone);
+			weights[j] = static_cast<uint8_t>(scaled);
+			remainders[j] = scaled - weights[j];
+			left -= weights[j];
+		}
+		for (; left > 0; left--)
+		{
+			j = static_cast<int32_t>(std::max_element(remainders.begin(), remainders.end()) - remainders.begin());
+			weights[j]++;
+			remainders[j] = -1.0f;
+		}
+
+		// rounding can leave a light one at nothing
+		while (kept > 1 && weights[kept - 1] == 0)
+			bones[--kept] = 0;
+	}
+	return true;
+}
+
+bool TSSkinMesh::SetInfluences(const TSSkinPack& pack)
+{
+	if (pack.influences != 4 && pack.influences != 8)
+		return false;
+
+	const int32_t num_verts = static_cast<int32_t>(initial_verts_.size());
+	const int32_t num_bones = static_cast<int32_t>(node_index_.size());
+	if (static_cast<int32_t>(pack.weights.size()) != num_verts * pack.influences ||
+		pack.bones.size() != pack.weights.size())
+		return false;
+	for (uint16_t bone : pack.bones)
+	{
+		if (bone >= num_bones)
+			return false;
+	}
+
+	vertex_index_.clear();
+	bone_index_.clear();
+	weight_.clear();
+	for (int32_t i = 0; i < num_verts; i++)
+	{
+		for (int32_t j = 0; j < pack.influences; j++)
+		{
+			uint8_t weight = pack.weights[i * pack.influences + j];
+			if (weight == 0)
+				break;
+			vertex_index_.push_back(i);
+			bone_index_.push_back(pack.bones[i * pack.influences + j]);
+			weight_.push_back(static_cast<float>(weight) / TSSkinPack::kWeightScale);
+		}
+	}
+
+	SetDirty();
+	return true;
+}
+
+void TSSkinMesh::Skin(const TSSkinPack& pack, const MatrixF* bones, Point3F* verts, Point3F* norms, int32_t threads) const
+{
+	const int32_t num_verts = static_cast<int32_t>(initial_verts_.size());
+	assert(static_cast<int32_t>(pack.weights.size()) == num_verts * pack.influences);
+
+	BonePalette palette;
+	SetPalette(bones, static_cast<int32_t>(node_index_.size()), &palette);
+
+	threads = NumThreads(threads, num_verts);
+	if (threads == 1)
+	{
+		SkinPackedRange(*this, pack, palette, 0, num_verts, verts, norms);
+		return;
+	}
+
+	SplitVerts(num_verts, threads, [&](int32_t first_vert, int32_t end_vert)
+	{
+		SkinPackedRange(*this, pack, palette, first_vert, end_vert, verts, norms);
+	});
+}
+
+} // namespace DTS
@@ -0,0 +1,119 @@
+#include "DTSNamePool.h"
+
+#include <cstring>
+
+namespace DTS
+{
+
+TSNamePool::TSNamePool()
+{
+
+}
+
+int32_t TSNamePool::GetLength(int32_t index) const
+{
+	int32_t end = (index + 1 < Size()) ? offsets_[index + 1] : GetBlockSize();
+	return end - offsets_[index] - 1;
+}
+
+uint32_t TSNamePool::Hash(const char* name, int32_t length)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (int32_t i = 0; i < length; i++)
+	{
+		hash ^= static_cast<uint8_t>(name[i]);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+int32_t TSNamePool::Find(const std::string& name) const
+{
+	if (slots_.empty())
+		return -1;
+
+	const int32_t length = static_cast<int32_t>(name.length());
+	const std::size_t mask = slots_.size() - 1;
+	for (std::size_t slot = Hash(name.c_str(), length) & mask; slots_[slot] >= 0; slot = (slot + 1) & mask)
+	{
+		int32_t index = slots_[slot];
+		if (GetLength(index) == length && !memcmp(Get(index), name.c_str(), length))
+			return index;
+	}
+
+	return -1;
+}
+
+int32_t TSNamePool::Add(const std::string& name)
+{
+	int32_t index = Find(name);
+	if (index >= 0)
+		return index;
+
+	index = Size();
+	offsets_.push_back(GetBlockSize());
+	block_.insert(block_.end(), name.c_str(), name.c_str() + name.length() + 1);
+	Index(index);
+	return index;
+}
+
+int32_t TSNamePool::SetBlock(const char* block, int32_t count)
+{
+	Clear();
+
+	const char* name = block;
+	offsets_.reserve(count);
+	for (int32_t i = 0; i < count; i++)
+	{
+		offsets_.push_back(static_cast<int32_t>(name - block));
+		name += strlen(name) + 1;
+	}
+
+	int32_t size = static_cast<int32_t>(name - block);
+	block_.assign(block, block + size);
+
+	Rehash(2 * count);
+	return size;
+}
+
+void TSNamePool::Clear()
+{
+	block_.clear();
+	offsets_.clear();
+	slots_.clear();
+}
+
+void TSNamePool::Index(int32_t index)
+{
+	if (2 * offsets_.size() > slots_.size())
+	{
+		Rehash(2 * offsets_.size());
+		return;
+	}
+
+	// only the first of any duplicates is found
+	const int32_t length = GetLength(index);
+	const std::size_t mask = slots_.size() - 1;
+	std::size_t slot = Hash(Get(index), length) & mask;
+	for (; slots_[slot] >= 0; slot = (slot + 1) & mask)
+	{
+		int32_t other = slots_[slot];
+		if (GetLength(other) == length && !memcmp(Get(other), Get(index), length))
+			return;
+	}
+	slots_[slot] = index;
+}
+
+void TSNamePool::Rehash(std::size_t num_slots)
+{
+	std::size_t size = 16;
+	while (size < num_slots)
+		size <<= 1;
+
+	slots_.assign(size, -1);
+	for (int32_t i = 0; i < Size(); i++)
+		Index(i);
+}
+
+} // namespace DTS
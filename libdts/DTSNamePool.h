@@ -0,0 +1,60 @@
+#ifndef DTS_NAMEPOOL_H_
+#define DTS_NAMEPOOL_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace DTS
+{
+
+// The shape's name table.  Names are kept null terminated, back to back in
+// one block (the same layout as the shape file's name section) and are
+// referred to by index.  Adding a name that is already there returns its
+// index, so two indices name the same string only if a file had duplicates.
+class TSNamePool
+{
+public:
+	TSNamePool();
+
+	int32_t Size() const { return static_cast<int32_t>(offsets_.size()); }
+	bool Empty() const { return offsets_.empty(); }
+
+	const char* Get(int32_t index) const { return &block_[offsets_[index]]; }
+	int32_t GetLength(int32_t index) const;
+	std::string GetString(int32_t index) const { return std::string(Get(index), GetLength(index)); }
+
+	// Returns the index of the (first) name equal to name, or -1
+	int32_t Find(const std::string& name) const;
+
+	// Returns the index of name, adding it if it is new
+	int32_t Add(const std::string& name);
+
+	// Replaces the names with count names read from a block laid out like
+	// ours.  Returns the number of bytes they took up.
+	int32_t SetBlock(const char* block, int32_t count);
+
+	// All the names, as written to the shape file
+	const char* GetBlock() const { return block_.empty() ? nullptr : &block_[0]; }
+	int32_t GetBlockSize() const { return static_cast<int32_t>(block_.size()); }
+
+	void Clear();
+
+	bool operator==(const TSNamePool& other) const { return offsets_ == other.offsets_ && block_ == other.block_; }
+	bool operator!=(const TSNamePool& other) const { return !(*this == other); }
+
+private:
+	static uint32_t Hash(const char* name, int32_t length);
+
+	// open addressed table of name indices, at most half full
+	void Index(int32_t index);
+	void Rehash(std::size_t num_slots);
+
+	std::vector<char> block_;
+	std::vector<int32_t> offsets_;
+	std::vector<int32_t> slots_;	// -1 when empty
+};
+
+} // namespace DTS
+
+#endif // DTS_NAMEPOOL_H_
@@ -3,6 +3,15 @@
 #include <cmath>
 
 #include "DTSMatrix.h"
+#include "DTSSimd.h"
+
+#if defined(DTS_AVX2)
+#define DTS_QUAT_LANES 8
+#elif defined(DTS_SSE2)
+#define DTS_QUAT_LANES 4
+#else
+#define DTS_QUAT_LANES 1
+#endif
 
 namespace DTS
 {
@@ -16,6 +25,224 @@ constexpr int Idx(int r, int c)
 	return r * 4 + c;
 }
 
+namespace
+{
+
+// How much of q1 and q2 make up the slerp between them, given their dot product
+void SlerpScales(float cos_omega, float t, float* scale1, float* scale2)
+{
+	// q and -q are the same rotation; take whichever of them is nearer q1
+	float sign = 1.0f;
+	if (cos_omega < 0.0f)
+	{
+		cos_omega = -cos_omega;
+		sign = -1.0f;
+	}
+
+	if (cos_omega < 0.9995f)
+	{
+		float omega = acosf(cos_omega);
+		float inv_sin_omega = 1.0f / sinf(omega);
+		*scale1 = sinf((1.0f - t) * omega) * inv_sin_omega;
+		*scale2 = sinf(t * omega) * inv_sin_omega * sign;
+	}
+	else
+	{
+		// too close together for the angle to be accurate; a straight line will do
+		*scale1 = 1.0f - t;
+		*scale2 = t * sign;
+	}
+}
+
+#if DTS_QUAT_LANES == 8
+
+typedef __m256 Lanes;
+
+inline Lanes Splat(float f) { return _mm256_set1_ps(f); }
+inline Lanes LoadLanes(const float* f) { return _mm256_loadu_ps(f); }
+inline void StoreLanes(float* f, Lanes a) { _mm256_storeu_ps(f, a); }
+inline Lanes Add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+inline Lanes Mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+inline Lanes Div(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+inline Lanes Sqrt(Lanes a) { return _mm256_sqrt_ps(a); }
+inline Lanes And(Lanes a, Lanes b) { return _mm256_and_ps(a, b); }
+inline Lanes AndNot(Lanes a, Lanes b) { return _mm256_andnot_ps(a, b); } // ~a & b
+inline Lanes Or(Lanes a, Lanes b) { return _mm256_or_ps(a, b); }
+inline Lanes Xor(Lanes a, Lanes b) { return _mm256_xor_ps(a, b); }
+inline Lanes Less(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline Lanes Equal(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+
+// 4x4 transpose within each half
+inline void Transpose(Lanes r[4])
+{
+	__m256d t0 = _mm256_castps_pd(_mm256_unpacklo_ps(r[0], r[1]));
+	__m256d t1 = _mm256_castps_pd(_mm256_unpacklo_ps(r[2], r[3]));
+	__m256d t2 = _mm256_castps_pd(_mm256_unpackhi_ps(r[0], r[1]));
+	__m256d t3 = _mm256_castps_pd(_mm256_unpackhi_ps(r[2], r[3]));
+	r[0] = _mm256_castpd_ps(_mm256_unpacklo_pd(t0, t1));
+	r[1] = _mm256_castpd_ps(_mm256_unpackhi_pd(t0, t1));
+	r[2] = _mm256_castpd_ps(_mm256_unpacklo_pd(t2, t3));
+	r[3] = _mm256_castpd_ps(_mm256_unpackhi_pd(t2, t3));
+}
+
+// r = the x, y, z and w of q[0], q[stride] .. q[7 * stride]
+inline void LoadQuats(const Quat16* q, int32_t stride, Lanes r[4])
+{
+	for (int32_t j = 0; j < 4; j++)
+	{
+		// quaternion j in the low half, j + 4 in the high half
+		__m128i lo = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(q + j * stride));
+		__m128i hi = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(q + (j + 4) * stride));
+		r[j] = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_unpacklo_epi64(lo, hi)));
+	}
+	Transpose(r);
+}
+
+inline void StoreQuats(Lanes r[4], QuatF* out)
+{
+	Transpose(r);
+	for (int32_t j = 0; j < 4; j++)
+	{
+		_mm_storeu_ps(&out[j].x, _mm256_castps256_ps128(r[j]));
+		_mm_storeu_ps(&out[j + 4].x, _mm256_extractf128_ps(r[j], 1));
+	}
+}
+
+#elif DTS_QUAT_LANES == 4
+
+typedef __m128 Lanes;
+
+inline Lanes Splat(float f) { return _mm_set1_ps(f); }
+inline Lanes LoadLanes(const float* f) { return _mm_loadu_ps(f); }
+inline void StoreLanes(float* f, Lanes a) { _mm_storeu_ps(f, a); }
+inline Lanes Add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+inline Lanes Mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+inline Lanes Div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+inline Lanes Sqrt(Lanes a) { return _mm_sqrt_ps(a); }
+inline Lanes And(Lanes a, Lanes b) { return _mm_and_ps(a, b); }
+inline Lanes AndNot(Lanes a, Lanes b) { return _mm_andnot_ps(a, b); } // ~a & b
+inline Lanes Or(Lanes a, Lanes b) { return _mm_or_ps(a, b); }
+inline Lanes Xor(Lanes a, Lanes b) { return _mm_xor_ps(a, b); }
+inline Lanes Less(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+inline Lanes Equal(Lanes a, Lanes b) { return _mm_cmpeq_ps(a, b); }
+
+// r = the x, y, z and w of q[0], q[stride] .. q[3 * stride]
+inline void LoadQuats(const Quat16* q, int32_t stride, Lanes r[4])
+{
+	for (int32_t j = 0; j < 4; j++)
+	{
+		// sign extend to 32 bits
+		__m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(q + j * stride));
+		r[j] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+	}
+	_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+}
+
+inline void StoreQuats(Lanes r[4], QuatF* out)
+{
+	_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+	for (int32_t j = 0; j < 4; j++)
+		_mm_storeu_ps(&out[j].x, r[j]);
+}
+
+#endif
+
+#if DTS_QUAT_LANES > 1
+
+const int32_t kLanes = DTS_QUAT_LANES;
+
+inline Lanes Dot(const Lanes a[4], const Lanes b[4])
+{
+	return Add(Add(Add(Mul(a[0], b[0]), Mul(a[1], b[1])), Mul(a[2], b[2])), Mul(a[3], b[3]));
+}
+
+// As QuatF::Normalize, a lane at a time
+inline void NormalizeQuats(Lanes r[4])
+{
+	Lanes length = Sqrt(Dot(r, r));
+	Lanes zero = Equal(length, Splat(0.0f));
+	for (int32_t j = 0; j < 4; j++)
+		r[j] = AndNot(zero, Div(r[j], length));
+	r[3] = Or(r[3], And(zero, Splat(1.0f)));
+}
+
+#endif
+
+// The scalar code the kernels fall back on, a quaternion at a time
+void DecodeQuat(const Quat16& in, QuatF* out)
+{
+	*out = in.GetQuatF();
+	out->Normalize();
+}
+
+template <bool kSlerp>
+void InterpolateQuat(const Quat16& q1, const Quat16& q2, float t, QuatF* out)
+{
+	QuatF a = q1.GetQuatF();
+	QuatF b = q2.GetQuatF();
+	if (kSlerp)
+		out->Interpolate(a, b, t);
+	else
+	{
+		float scale2 = (a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w < 0.0f) ? -t : t;
+		out->Set(a.x * (1.0f - t) + b.x * scale2,
+			a.y * (1.0f - t) + b.y * scale2,
+			a.z * (1.0f - t) + b.z * scale2,
+			a.w * (1.0f - t) + b.w * scale2).Normalize();
+	}
+}
+
+template <bool kSlerp>
+void InterpolateQuats(const Quat16* q1, const Quat16* q2, int32_t stride, float t, QuatF* out, int32_t count)
+{
+	int32_t i = 0, j;
+
+#if DTS_QUAT_LANES > 1
+	const Lanes max_val = Splat(Quat16::kMaxVal);
+	for (; i + kLanes <= count; i += kLanes)
+	{
+		Lanes a[4], b[4];
+		LoadQuats(q1 + i * stride, stride, a);
+		LoadQuats(q2 + i * stride, stride, b);
+		for (j = 0; j < 4; j++)
+		{
+			a[j] = Div(a[j], max_val);
+			b[j] = Div(b[j], max_val);
+		}
+		Lanes dot = Dot(a, b);
+
+		Lanes scale1, scale2;
+		if (kSlerp)
+		{
+			// the angles are worked out a lane at a time
+			float cos_omega[kLanes], s1[kLanes], s2[kLanes];
+			StoreLanes(cos_omega, dot);
+			for (j = 0; j < kLanes; j++)
+				SlerpScales(cos_omega[j], t, &s1[j], &s2[j]);
+			scale1 = LoadLanes(s1);
+			scale2 = LoadLanes(s2);
+		}
+		else
+		{
+			// -t where q2 is on the far side of q1
+			scale1 = Splat(1.0f - t);
+			scale2 = Xor(Splat(t), And(Less(dot, Splat(0.0f)), Splat(-0.0f)));
+		}
+
+		for (j = 0; j < 4; j++)
+			a[j] = Add(Mul(a[j], scale1), Mul(b[j], scale2));
+		NormalizeQuats(a);
+		StoreQuats(a, out + i);
+	}
+#endif
+
+// the rest, a quaternion at a time
+	for (; i < count; i++)
+		InterpolateQuat<kSlerp>(q1[i * stride], q2[i * stride], t, &out[i]);
+}
+
+} // namespace
+
 QuatF& QuatF::Set(const MatrixF& mat)
 {
 	float const *m = mat;
@@ -92,6 +319,20 @@ MatrixF* QuatF::SetMatrix(MatrixF* mat) const
 	return mat;
 }
 
+QuatF& QuatF::Interpolate(const QuatF& q1, const QuatF& q2, float t)
+{
+	float scale1, scale2;
+	SlerpScales(q1.x * q2.x + q1.y * q2.y + q1.z * q2.z + q1.w * q2.w, t, &scale1, &scale2);
+
+	x = scale1 * q1.x + scale2 * q2.x;
+	y = scale1 * q1.y + scale2 * q2.y;
+	z = scale1 * q1.z + scale2 * q2.z;
+	w = scale1 * q1.w + scale2 * q2.w;
+
+	// compressed keys are only nearly unit length
+	return Normalize();
+}
+
 QuatF &QuatF::Normalize()
 {
 	float l = sqrt(x * x + y * y + z * z + w * w);
@@ -123,4 +364,34 @@ void Quat16::Set(const QuatF& q)
 	w = static_cast<int16_t>(q.w * kMaxVal);
 }
 
+void DecodeQuats(const Quat16* in, int32_t stride, QuatF* out, int32_t count)
+{
+	int32_t i = 0;
+
+#if DTS_QUAT_LANES > 1
+	// no need to scale down by kMaxVal before normalizing
+	for (; i + kLanes <= count; i += kLanes)
+	{
+		Lanes r[4];
+		LoadQuats(in + i * stride, stride, r);
+		NormalizeQuats(r);
+		StoreQuats(r, out + i);
+	}
+#endif
+
+	// the rest, a quaternion at a time
+	for (; i < count; i++)
+		DecodeQuat(in[i * stride], &out[i]);
+}
+
+void NlerpQuats(const Quat16* q1, const Quat16* q2, int32_t stride, float t, QuatF* out, int32_t count)
+{
+	InterpolateQuats<false>(q1, q2, stride, t, out, count);
+}
+
+void SlerpQuats(const Quat16* q1, const Quat16* q2, int32_t stride, float t, QuatF* out, int32_t count)
+{
+	InterpolateQuats<true>(q1, q2, stride, t, out, count);
+}
+
 } // namespace DTS
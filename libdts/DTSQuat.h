@@ -25,6 +25,9 @@ public:
 	QuatF& Normalize();
 	QuatF& Identity();
 
+	// Spherical interpolation from q1 (t = 0) to q2 (t = 1), the short way round
+	QuatF& Interpolate(const QuatF& q1, const QuatF& q2, float t);
+
 	float x, y, z, w;
 };
 
@@ -68,6 +71,20 @@ public:
 	int16_t x, y, z, w;
 };
 
+// Batch kernels, for posing many nodes at once.  Compressed quaternions are
+// read every stride entries, so that one keyframe's keys can be read in place
+// from a sequence (which keeps each node's keys together).  They use SSE2
+// or AVX2 where they can (see DTSSimd.h).
+
+// out[i] = in[i * stride], decompressed and normalized
+void DecodeQuats(const Quat16* in, int32_t stride, QuatF* out, int32_t count);
+
+// out[i] = q1[i * stride] to q2[i * stride] by t, the short way round.  Nlerp
+// goes in a straight line and renormalizes: cheaper, and close to slerp for
+// keys near each other.
+void NlerpQuats(const Quat16* q1, const Quat16* q2, int32_t stride, float t, QuatF* out, int32_t count);
+void SlerpQuats(const Quat16* q1, const Quat16* q2, int32_t stride, float t, QuatF* out, int32_t count);
+
 } // namespace DTS
 
 #endif // DTS_QUAT_H_
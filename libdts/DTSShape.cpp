@@ -1,25 +1,62 @@
 #include "DTSShape.h"
 
+#include <algorithm>
 #include <fstream>
+#include <mutex>
 
+#include "DTSMappedFile.h"
 #include "DTSMaterialList.h"
 #include "DTSStream.h"
+#include "DTSWorkerPool.h"
 
 namespace DTS
 {
 
+namespace
+{
+
+// Brings every mesh's write cache up to date, when the shape keeps them
+void UpdateWriteCaches(const std::vector<TSMesh*>& meshes, bool cache_writes, TSWorkerPool& pool)
+{
+	if (!cache_writes)
+		return;
+
+	pool.Run(static_cast<int32_t>(meshes.size()), [&](int32_t i)
+	{
+		if (meshes[i])
+			meshes[i]->UpdateWriteCache();
+	});
+}
+
+// Assembles a mesh, keeping what it was read from as its write cache
+TSMesh* AssembleCachedMesh(ITSShapeAlloc& alloc, uint32_t mesh_type)
+{
+	std::vector<ITSShapeAlloc::ReadPosition> guards;
+	ITSShapeAlloc::ReadPosition start = alloc.GetReadPosition();
+	alloc.SetGuardLog(&guards);
+	TSMesh* mesh = TSMesh::AssembleMesh(alloc, mesh_type, false);
+	alloc.SetGuardLog(nullptr);
+
+	if (mesh)
+	{
+		std::unique_ptr<OTSShapeAlloc> fragment(new OTSShapeAlloc);
+		fragment->SetFragment(start, alloc.GetReadPosition(), guards);
+		mesh->SetWriteCache(std::move(fragment));
+	}
+	return mesh;
+}
+
+} // namespace
+
 // most recent version -- this is the version we write
 const int32_t TSShape::kVersion = 24;
-// Version currently being read, only valid during read
-int32_t TSShape::current_read_version_ = -1;
 const int32_t TSShape::kMostRecentExporterVersion = 124;
 
-TSShapeAlloc TSShape::alloc_;
-
-#define tsalloc TSShape::alloc_
-
 TSShape::TSShape() :
-	material_list_(nullptr), read_version_(-1), shape_data_(nullptr), shape_data_size_(0)
+	material_list_(nullptr), read_version_(-1), shape_data_(nullptr), shape_data_size_(0),
+	lazy_alloc_(nullptr), lazy_buffer_(nullptr), cache_writes_(false),
+	edit_depth_(0), edit_num_nodes_(0), edit_num_objects_(0),
+	lookup_names_(0), lookup_nodes_(0), lookup_objects_(0)
 {
 
 }
@@ -32,56 +69,114 @@ TSShape::TSShape(const std::string& filename)
 
 TSShape::~TSShape()
 {
+	// an unfinished edit holds the objects' meshes, including any added
+	// since BeginEdit, in edit_meshes_; nothing else needs fixing up
+	if (IsEditing())
+	{
+		meshes_.clear();
+		for (std::size_t i = 0; i < edit_meshes_.size(); i++)
+			meshes_.insert(meshes_.end(), edit_meshes_[i].begin(), edit_meshes_[i].end());
+	}
+
 	delete material_list_;
 
 	int32_t i;
 
 	// everything left over here is a legit mesh
 	for (i = 0; i < meshes_.size(); i++)
-	{
-		if (!meshes_[i])
-			continue;
-
-		// Handle meshes that were either assembled with the shape or added later
-		if ((reinterpret_cast<int8_t*>(meshes_[i]) >= shape_data_) && (reinterpret_cast<int8_t*>(meshes_[i]) < (shape_data_ + shape_data_size_)))
-			meshes_[i]->~TSMesh();
-		else
-			delete meshes_[i];
-	}
+		DeleteMesh(meshes_[i]);
 
 	if (shape_data_)
 		delete[] shape_data_;
+
+	delete lazy_alloc_;
+	delete[] lazy_buffer_;
 }
 
-int32_t TSShape::FindName(const std::string& name) const
+void TSShape::DeleteMesh(TSMesh* mesh)
 {
-	for (int32_t i = 0; i < names_.size(); i++)
-	{
-		if (names_[i] == name)
-			return i;
-	}
+	if (!mesh)
+		return;
 
-	return -1;
+	// Handle meshes that were either assembled with the shape or added later
+	if ((reinterpret_cast<int8_t*>(mesh) >= shape_data_) && (reinterpret_cast<int8_t*>(mesh) < (shape_data_ + shape_data_size_)))
+		mesh->~TSMesh();
+	else
+		delete mesh;
+}
+
+int32_t TSShape::FindName(const std::string& name) const
+{
+	return names_.Find(name);
 }
 
 int32_t TSShape::FindNode(int32_t name_index) const
 {
-	for (int32_t i = 0; i < nodes_.size(); i++)
-		if (nodes_[i].name_index == name_index)
-			return i;
-	return -1;
+	UpdateLookup();
+	if (name_index < 0 || name_index >= static_cast<int32_t>(node_lookup_.size()))
+		return -1;
+	return node_lookup_[name_index];
 }
 
 int32_t TSShape::FindObject(int32_t name_index) const
 {
-	for (int32_t i = 0; i < objects_.size(); i++)
-		if (objects_[i].name_index == name_index)
+	UpdateLookup();
+	if (name_index < 0 || name_index >= static_cast<int32_t>(object_lookup_.size()))
+		return -1;
+	return object_lookup_[name_index];
+}
+
+int32_t TSShape::FindSequence(const std::string& name) const
+{
+	int32_t name_index = FindName(name);
+	if (name_index < 0)
+		return -1;
+
+	for (int32_t i = 0; i < static_cast<int32_t>(sequences_.size()); i++)
+	{
+		if (sequences_[i].name_index_ == name_index)
 			return i;
+	}
 	return -1;
 }
 
+void TSShape::RebuildLookup() const
+{
+	int32_t i;
+
+	// the first of any duplicates wins, as with a search from the front
+	node_lookup_.assign(names_.Size(), -1);
+	for (i = 0; i < static_cast<int32_t>(nodes_.size()); i++)
+	{
+		int32_t name_index = nodes_[i].name_index;
+		if (name_index >= 0 && name_index < names_.Size() && node_lookup_[name_index] < 0)
+			node_lookup_[name_index] = i;
+	}
+
+	object_lookup_.assign(names_.Size(), -1);
+	for (i = 0; i < static_cast<int32_t>(objects_.size()); i++)
+	{
+		int32_t name_index = objects_[i].name_index;
+		if (name_index >= 0 && name_index < names_.Size() && object_lookup_[name_index] < 0)
+			object_lookup_[name_index] = i;
+	}
+
+	lookup_names_ = names_.Size();
+	lookup_nodes_ = nodes_.size();
+	lookup_objects_ = objects_.size();
+}
+
+void TSShape::UpdateLookup() const
+{
+	if (lookup_names_ != static_cast<std::size_t>(names_.Size()) || lookup_nodes_ != nodes_.size() || lookup_objects_ != objects_.size())
+		RebuildLookup();
+}
+
 int32_t TSShape::GetSubShapeForNode(int32_t node_index)
 {
+	if (IsEditing() && node_index >= edit_num_nodes_)
+		return edit_node_sub_shapes_[node_index - edit_num_nodes_];
+
 	for (int32_t i = 0; i < sub_shape_first_node_.size(); i++)
 	{
 		int32_t start = sub_shape_first_node_[i];
@@ -94,6 +189,9 @@ int32_t TSShape::GetSubShapeForNode(int32_t node_index)
 
 int32_t TSShape::GetSubShapeForObject(int32_t obj_index)
 {
+	if (IsEditing() && obj_index >= edit_num_objects_)
+		return edit_object_sub_shapes_[obj_index - edit_num_objects_];
+
 	for (int32_t i = 0; i < sub_shape_first_object_.size(); i++)
 	{
 		int32_t start = sub_shape_first_object_[i];
@@ -115,207 +213,265 @@ void TSShape::GetSubShapeDetails(int32_t sub_shape_index, std::vector<int32_t>&
 	}
 }
 
+void TSShape::GetSubShapeObjects(int32_t sub_shape_index, std::vector<int32_t>& objects)
+{
+	objects.clear();
+	for (int32_t i = 0; i < sub_shape_num_objects_[sub_shape_index]; i++)
+		objects.push_back(sub_shape_first_object_[sub_shape_index] + i);
+
+	// objects appended by an edit go at the end of their sub-shape
+	for (int32_t i = 0; i < static_cast<int32_t>(edit_object_sub_shapes_.size()); i++)
+	{
+		if (edit_object_sub_shapes_[i] == sub_shape_index)
+			objects.push_back(edit_num_objects_ + i);
+	}
+}
+
 void TSShape::GetNodeWorldTransform(int32_t node_index, MatrixF* mat) const
 {
 	if (node_index == -1)
 	{
 		mat->Identity();
+		return;
 	}
-	else
+
+	std::lock_guard<std::mutex> lock(world_mutex_);
+	if (world_valid_.size() != nodes_.size())
 	{
-		// Calculate the world transform of the given node
-		default_rotations_[node_index].GetQuatF().SetMatrix(mat);
-		mat->SetPosition(default_translations_[node_index]);
+		world_transforms_.resize(nodes_.size());
+		world_valid_.assign(nodes_.size(), false);
+	}
+
+	if (!world_valid_[node_index])
+	{
+		// Work down to the node from its closest ancestor that's known (or its root)
+		std::vector<int32_t> chain;
+		for (int32_t i = node_index; i != -1 && !world_valid_[i]; i = nodes_[i].parent_index)
+			chain.push_back(i);
 
-		int32_t parent_index = nodes_[node_index].parent_index;
-		while (parent_index != -1)
+		for (int32_t j = static_cast<int32_t>(chain.size()) - 1; j >= 0; j--)
 		{
-			MatrixF mat2(*mat);
-			default_rotations_[parent_index].GetQuatF().SetMatrix(mat);
-			mat->SetPosition(default_translations_[parent_index]);
-			mat->Mul(mat2);
+			int32_t i = chain[j];
+			MatrixF local;
+			default_rotations_[i].GetQuatF().SetMatrix(&local);
+			local.SetPosition(default_translations_[i]);
+
+			int32_t parent_index = nodes_[i].parent_index;
+			if (parent_index == -1)
+				world_transforms_[i] = local;
+			else
+				world_transforms_[i].Mul(world_transforms_[parent_index], local);
+			world_valid_[i] = true;
+		}
+	}
+
+	*mat = world_transforms_[node_index];
+}
 
-			parent_index = nodes_[parent_index].parent_index;
+void TSShape::InvalidateWorldTransforms() const
+{
+	std::lock_guard<std::mutex> lock(world_mutex_);
+	world_transforms_.resize(nodes_.size());
+	world_valid_.assign(nodes_.size(), false);
+}
+
+void TSShape::InvalidateWorldTransform(int32_t node_index) const
+{
+	// Nothing below a node that isn't known is known either
+	std::lock_guard<std::mutex> lock(world_mutex_);
+	if (world_valid_.size() != nodes_.size() || node_index < 0 || !world_valid_[node_index])
+		return;
+
+	// Find the rest of its subtree in one pass, remembering for each node
+	// whether it is in it (1) or not (0) so no chain is walked twice
+	std::vector<int8_t> in_subtree(nodes_.size(), -1);
+	in_subtree[node_index] = 1;
+
+	std::vector<int32_t> chain;
+	for (int32_t i = 0; i < static_cast<int32_t>(nodes_.size()); i++)
+	{
+		int32_t j = i;
+		while (j != -1 && in_subtree[j] < 0 && world_valid_[j])
+		{
+			chain.push_back(j);
+			j = nodes_[j].parent_index;
 		}
+
+		int8_t member = (j != -1 && world_valid_[j]) ? in_subtree[j] : 0;
+		for (std::size_t k = 0; k < chain.size(); k++)
+			in_subtree[chain[k]] = member;
+		chain.clear();
+	}
+
+	for (int32_t i = 0; i < static_cast<int32_t>(nodes_.size()); i++)
+	{
+		if (in_subtree[i] == 1)
+			world_valid_[i] = false;
 	}
 }
 
-void TSShape::AssembleShape()
+void TSShape::AssembleShape(ITSShapeAlloc& alloc, const LoadOptions& options)
 {
 	int32_t i, j;
-
-	int32_t num_nodes = tsalloc.IMemBuffer32::Get();
-	int32_t num_objects = tsalloc.IMemBuffer32::Get();
-	int32_t num_decals = tsalloc.IMemBuffer32::Get();
-	int32_t num_sub_shapes = tsalloc.IMemBuffer32::Get();
-	int32_t num_ifl_materials = tsalloc.IMemBuffer32::Get();
+	int32_t read_version = alloc.GetReadVersion();
+	cache_writes_ = options.cache_writes;
+
+	int32_t num_nodes = alloc.IMemBuffer32::Get();
+	int32_t num_objects = alloc.IMemBuffer32::Get();
+	int32_t num_decals = alloc.IMemBuffer32::Get();
+	int32_t num_sub_shapes = alloc.IMemBuffer32::Get();
+	int32_t num_ifl_materials = alloc.IMemBuffer32::Get();
 	int32_t num_node_rots;
 	int32_t num_node_trans;
 	int32_t num_node_uniform_scales;
 	int32_t num_node_aligned_scales;
 	int32_t num_node_arbitrary_scales;
-	if (current_read_version_ < 22)
+	if (read_version < 22)
 	{
-		num_node_rots = num_node_trans = tsalloc.IMemBuffer32::Get() - num_nodes;
+		num_node_rots = num_node_trans = alloc.IMemBuffer32::Get() - num_nodes;
 		num_node_uniform_scales = num_node_aligned_scales = num_node_arbitrary_scales = 0;
 	}
 	else
 	{
-		num_node_rots = tsalloc.IMemBuffer32::Get();
-		num_node_trans = tsalloc.IMemBuffer32::Get();
-		num_node_uniform_scales = tsalloc.IMemBuffer32::Get();
-		num_node_aligned_scales = tsalloc.IMemBuffer32::Get();
-		num_node_arbitrary_scales = tsalloc.IMemBuffer32::Get();
+		num_node_rots = alloc.IMemBuffer32::Get();
+		num_node_trans = alloc.IMemBuffer32::Get();
+		num_node_uniform_scales = alloc.IMemBuffer32::Get();
+		num_node_aligned_scales = alloc.IMemBuffer32::Get();
+		num_node_arbitrary_scales = alloc.IMemBuffer32::Get();
 	}
 	int32_t num_ground_frames = 0;
-	if (current_read_version_ > 23)
-		num_ground_frames = tsalloc.IMemBuffer32::Get();
-	int32_t num_object_states = tsalloc.IMemBuffer32::Get();
-	int32_t num_decal_states = tsalloc.IMemBuffer32::Get();
-	int32_t num_triggers = tsalloc.IMemBuffer32::Get();
-	int32_t num_details = tsalloc.IMemBuffer32::Get();
-	int32_t num_meshes = tsalloc.IMemBuffer32::Get();
+	if (read_version > 23)
+		num_ground_frames = alloc.IMemBuffer32::Get();
+	int32_t num_object_states = alloc.IMemBuffer32::Get();
+	int32_t num_decal_states = alloc.IMemBuffer32::Get();
+	int32_t num_triggers = alloc.IMemBuffer32::Get();
+	int32_t num_details = alloc.IMemBuffer32::Get();
+	int32_t num_meshes = alloc.IMemBuffer32::Get();
 	int32_t num_skins = 0;
-	if (current_read_version_ < 23)
+	if (read_version < 23)
 		// in later versions, skins are kept with other meshes
-		num_skins = tsalloc.IMemBuffer32::Get();
-	int32_t num_names = tsalloc.IMemBuffer32::Get();
+		num_skins = alloc.IMemBuffer32::Get();
+	int32_t num_names = alloc.IMemBuffer32::Get();
 
-	smallest_visible_size_ = static_cast<float>(tsalloc.IMemBuffer32::Get());
-	smallest_visible_dl_ = tsalloc.IMemBuffer32::Get();
+	smallest_visible_size_ = static_cast<float>(alloc.IMemBuffer32::Get());
+	smallest_visible_dl_ = alloc.IMemBuffer32::Get();
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
 	// get bounds...
-	tsalloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&radius_), 1);
-	tsalloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&tube_radius_), 1);
-	tsalloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&center_), 3);
-	tsalloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&bounds_), 6);
+	alloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&radius_), 1);
+	alloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&tube_radius_), 1);
+	alloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&center_), 3);
+	alloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&bounds_), 6);
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
 	// copy various vectors...
-	int32_t* ptr32 = tsalloc.IMemBuffer32::CopyToShape(num_nodes * 5);
+	int32_t* ptr32 = alloc.IMemBuffer32::GetPointer(num_nodes * 5);
 	Vector::Set(nodes_, ptr32, num_nodes);
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
-	ptr32 = tsalloc.IMemBuffer32::CopyToShape(num_objects * 6, true);
-	if (!ptr32)
-		ptr32 = tsalloc.IMemBuffer32::AllocShape(num_skins * 6); // pre v23 shapes store skins and meshes separately...no longer
-	else
-		tsalloc.IMemBuffer32::AllocShape(num_skins * 6);
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_objects * 6);
 	Vector::Set(objects_, ptr32, num_objects);
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
 	// DEPRECATED decals
-	ptr32 = tsalloc.IMemBuffer32::GetPointer(num_decals * 5);
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_decals * 5);
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
 	// DEPRECATED ifl materials
-	ptr32 = tsalloc.IMemBuffer32::CopyToShape(num_ifl_materials * 5);
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_ifl_materials * 5);
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
-	ptr32 = tsalloc.IMemBuffer32::CopyToShape(num_sub_shapes, true);
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_sub_shapes);
 	Vector::Set(sub_shape_first_node_, ptr32, num_sub_shapes);
-	ptr32 = tsalloc.IMemBuffer32::CopyToShape(num_sub_shapes, true);
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_sub_shapes);
 	Vector::Set(sub_shape_first_object_, ptr32, num_sub_shapes);
 	// DEPRECATED subShapeFirstDecal
-	ptr32 = tsalloc.IMemBuffer32::GetPointer(num_sub_shapes);
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_sub_shapes);
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
-	ptr32 = tsalloc.IMemBuffer32::CopyToShape(num_sub_shapes);
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_sub_shapes);
 	Vector::Set(sub_shape_num_nodes_, ptr32, num_sub_shapes);
-	ptr32 = tsalloc.IMemBuffer32::CopyToShape(num_sub_shapes);
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_sub_shapes);
 	Vector::Set(sub_shape_num_objects_, ptr32, num_sub_shapes);
 	// DEPRECATED subShapeNumDecals
-	ptr32 = tsalloc.IMemBuffer32::CopyToShape(num_sub_shapes);
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_sub_shapes);
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
 	// get default translation and rotation
-	int16_t* ptr16 = tsalloc.IMemBuffer16::AllocShape(0);
-	for (i = 0; i < num_nodes; i++)
-		tsalloc.IMemBuffer16::CopyToShape(4);
+	int16_t* ptr16 = alloc.IMemBuffer16::GetPointer(num_nodes * 4);
 	Vector::Set(default_rotations_, ptr16, num_nodes);
-	tsalloc.Align32();
-	ptr32 = tsalloc.IMemBuffer32::AllocShape(0);
-	for (i = 0; i < num_nodes; i++)
-	{
-		tsalloc.IMemBuffer32::CopyToShape(3);
-		tsalloc.IMemBuffer32::CopyToShape(sizeof(Point3F) - 12); // handle alignment issues w/ point3f
-	}
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_nodes * 3);
 	Vector::Set(default_translations_, ptr32, num_nodes);
 
 	// get any node sequence data stored in shape
 	node_translations_.resize(num_node_trans);
 	for (i = 0; i < num_node_trans; i++)
-		tsalloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&node_translations_[i]), 3);
+		alloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&node_translations_[i]), 3);
 	node_rotations_.resize(num_node_rots);
 	for (i = 0; i < num_node_rots; i++)
-		tsalloc.IMemBuffer16::Get(reinterpret_cast<int16_t*>(&node_rotations_[i]), 4);
-	tsalloc.Align32();
+		alloc.IMemBuffer16::Get(reinterpret_cast<int16_t*>(&node_rotations_[i]), 4);
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
-	if (current_read_version_ > 21)
+	if (read_version > 21)
 	{
 		// more node sequence data...scale
 		node_uniform_scales_.resize(num_node_uniform_scales);
 		for (i = 0; i < num_node_uniform_scales; i++)
-			tsalloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&node_uniform_scales_[i]), 1);
+			alloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&node_uniform_scales_[i]), 1);
 		node_aligned_scales_.resize(num_node_aligned_scales);
 		for (i = 0; i < num_node_aligned_scales; i++)
-			tsalloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&node_aligned_scales_[i]), 3);
+			alloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&node_aligned_scales_[i]), 3);
 		node_arbitrary_scale_factors_.resize(num_node_arbitrary_scales);
 		for (i = 0; i < num_node_arbitrary_scales; i++)
-			tsalloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&node_arbitrary_scale_factors_[i]), 3);
+			alloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&node_arbitrary_scale_factors_[i]), 3);
 		node_arbitrary_scale_rots_.resize(num_node_arbitrary_scales);
 		for (i = 0; i < num_node_arbitrary_scales; i++)
-			tsalloc.IMemBuffer16::Get(reinterpret_cast<int16_t*>(&node_arbitrary_scale_rots_[i]), 4);
-		tsalloc.Align32();
+			alloc.IMemBuffer16::Get(reinterpret_cast<int16_t*>(&node_arbitrary_scale_rots_[i]), 4);
 
-		tsalloc.CheckGuard();
+		alloc.CheckGuard();
 	}
 
-	if (current_read_version_ > 23)
+	if (read_version > 23)
 	{
 		ground_translations_.resize(num_ground_frames);
 		for (i = 0; i < num_ground_frames; i++)
-			tsalloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&ground_translations_[i]), 3);
+			alloc.IMemBuffer32::Get(reinterpret_cast<int32_t*>(&ground_translations_[i]), 3);
 		ground_rotations_.resize(num_ground_frames);
 		for (i = 0; i < num_ground_frames; i++)
-			tsalloc.IMemBuffer16::Get(reinterpret_cast<int16_t*>(&ground_rotations_[i]), 4);
-		tsalloc.Align32();
+			alloc.IMemBuffer16::Get(reinterpret_cast<int16_t*>(&ground_rotations_[i]), 4);
 
-		tsalloc.CheckGuard();
+		alloc.CheckGuard();
 	}
 
 	// object states
-	ptr32 = tsalloc.IMemBuffer32::CopyToShape(num_object_states * 3);
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_object_states * 3);
 	Vector::Set(object_states_, ptr32, num_object_states);
-	tsalloc.IMemBuffer32::AllocShape(num_skins * 3); // provide buffer after object_states_ for older shapes
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
 	// DEPRECATED decal states
-	ptr32 = tsalloc.IMemBuffer32::GetPointer(num_decal_states);
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_decal_states);
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
 	// frame triggers
-	ptr32 = tsalloc.IMemBuffer32::GetPointer(num_triggers * 2);
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_triggers * 2);
 	triggers_.resize(num_triggers);
 	memcpy(Vector::Address(triggers_), ptr32, sizeof(int32_t) * num_triggers * 2);
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
 	// details
-	ptr32 = tsalloc.IMemBuffer32::CopyToShape(num_details * 7, true);
+	ptr32 = alloc.IMemBuffer32::GetPointer(num_details * 7);
 	Vector::Set(details_, ptr32, num_details);
 
 	// Some DTS exporters (MAX - I'm looking at you!) write garbage into the
@@ -335,122 +491,168 @@ void TSShape::AssembleShape()
 	// now that we have the details loaded.
 	UpdateSmallestVisibleDL();
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
 	// about to read in the meshes...first must allocate some scratch space
-	int32_t scratch_size = std::max(num_skins, num_meshes);
-	TSMesh::verts_list_.resize(scratch_size);
-	TSMesh::tverts_list_.resize(scratch_size);
-	TSMesh::norms_list_.resize(scratch_size);
-	TSMesh::encoded_norms_list_.resize(scratch_size);
-	TSMesh::data_copied_.resize(scratch_size);
-	TSSkinMesh::init_transform_list_.resize(scratch_size);
-	TSSkinMesh::vertex_index_list_.resize(scratch_size);
-	TSSkinMesh::bone_index_list_.resize(scratch_size);
-	TSSkinMesh::weight_list_.resize(scratch_size);
-	TSSkinMesh::node_index_list_.resize(scratch_size);
-	for (i = 0; i < num_meshes; i++)
+	alloc.ClearMeshLists(std::max(num_skins, num_meshes));
+
+	// meshes of the details being dropped are skipped
+	std::vector<bool> skip_mesh(num_meshes, options.skip_meshes);
+	for (i = 0; i < num_details; i++)
 	{
-		TSMesh::verts_list_[i] = nullptr;
-		TSMesh::tverts_list_[i] = nullptr;
-		TSMesh::norms_list_[i] = nullptr;
-		TSMesh::encoded_norms_list_[i] = nullptr;
-		TSMesh::data_copied_[i] = false;
-		TSSkinMesh::init_transform_list_[i] = nullptr;
-		TSSkinMesh::vertex_index_list_[i] = nullptr;
-		TSSkinMesh::bone_index_list_[i] = nullptr;
-		TSSkinMesh::weight_list_[i] = nullptr;
-		TSSkinMesh::node_index_list_[i] = nullptr;
+		const Detail& detail = details_[i];
+		if (detail.sub_shape_num < 0 || detail.sub_shape_num >= num_sub_shapes || !IsDetailSkipped(i, options))
+			continue;
+
+		int32_t first_object = sub_shape_first_object_[detail.sub_shape_num];
+		int32_t end_object = std::min(first_object + sub_shape_num_objects_[detail.sub_shape_num], num_objects);
+		for (j = std::max(first_object, 0); j < end_object; j++)
+		{
+			int32_t mesh_index = objects_[j].start_mesh_index + detail.object_detail_num;
+			if (detail.object_detail_num < objects_[j].num_meshes && mesh_index >= 0 && mesh_index < num_meshes)
+				skip_mesh[mesh_index] = true;
+		}
 	}
 
+	// Everything else is read straight into the shape's vectors, so all the
+	// buffer has to hold is the meshes themselves.
+	int32_t num_assembled = static_cast<int32_t>(std::count(skip_mesh.begin(), skip_mesh.end(), false));
+	if (!options.skip_meshes)
+		num_assembled += num_skins;
+	alloc.DoAlloc(num_assembled * TSMesh::GetMaxMeshSize());
+
+	// Lazy meshes are walked past for now, keeping where they start and room
+	// for them.  Pre v23 skins reuse the mesh lists, so those shapes load eagerly.
+	bool lazy = options.lazy_meshes && read_version >= 23;
+	lazy_meshes_.clear();
+	if (lazy)
+		lazy_meshes_.assign(num_meshes, LazyMesh());
+
 	// read in the meshes (sans skins)...straightforward read one at a time
-	TSMesh **ptrmesh = reinterpret_cast<TSMesh**>(tsalloc.IMemBuffer32::AllocShape((num_meshes + num_skins * num_details) * (sizeof(TSMesh*) / 4)));
+	meshes_.resize(num_meshes);
 	for (i = 0; i < num_meshes; i++)
 	{
 		bool skip = false;
-		int32_t mesh_type = tsalloc.IMemBuffer32::Get();
+		int32_t mesh_type = alloc.IMemBuffer32::Get();
+		if (skip_mesh[i])
+		{
+			// still records where its data is, for any meshes sharing it
+			TSMesh::SkipMesh(alloc, mesh_type, i);
+			meshes_[i] = nullptr;
+			continue;
+		}
+		if (lazy && mesh_type != TSMesh::kDecalMeshType && mesh_type != TSMesh::kNullMeshType)
+		{
+			LazyMesh& lazy_mesh = lazy_meshes_[i];
+			lazy_mesh.mesh_type = mesh_type;
+			lazy_mesh.position = alloc.GetReadPosition();
+			lazy_mesh.dest = reinterpret_cast<int8_t*>(alloc.IMemBuffer32::AllocShape(TSMesh::GetMaxMeshSize() >> 2));
+			TSMesh::SkipMesh(alloc, mesh_type, i);
+			meshes_[i] = nullptr;
+			continue;
+		}
 		if (mesh_type == TSMesh::kDecalMeshType)
 			// decal mesh deprecated
 			skip = true;
-		TSMesh* mesh = TSMesh::AssembleMesh(mesh_type, skip);
-		if (ptrmesh)
-		{
-			ptrmesh[i] = skip ? nullptr : mesh;
-		}
+		// meshes are only kept as read if we'd write them the same way
+		TSMesh* mesh;
+		if (cache_writes_ && !skip && read_version == kVersion)
+			mesh = AssembleCachedMesh(alloc, mesh_type);
+		else
+			mesh = TSMesh::AssembleMesh(alloc, mesh_type, skip);
+		meshes_[i] = mesh;
 
 		// fill in location of verts, tverts, and normals for detail levels
 		if (mesh && mesh_type != TSMesh::kDecalMeshType)
 		{
-			TSMesh::verts_list_[i] = Vector::Address(mesh->verts_);
-			TSMesh::tverts_list_[i] = Vector::Address(mesh->tverts_);
-			TSMesh::norms_list_[i] = Vector::Address(mesh->norms_);
-			TSMesh::encoded_norms_list_[i] = Vector::Address(mesh->encoded_norms_);
-			TSMesh::data_copied_[i] = !skip; // as long as we didn't skip this mesh, the data should be in shape now
+			alloc.verts_list_[i] = Vector::Address(mesh->verts_);
+			alloc.tverts_list_[i] = Vector::Address(mesh->tverts_);
+			alloc.norms_list_[i] = Vector::Address(mesh->norms_);
+			alloc.encoded_norms_list_[i] = Vector::Address(mesh->encoded_norms_);
 			if (mesh_type == TSMesh::kSkinMeshType)
 			{
 				TSSkinMesh* skin = static_cast<TSSkinMesh*>(mesh);
-				TSMesh::verts_list_[i] = Vector::Address(skin->initial_verts_);
-				TSMesh::norms_list_[i] = Vector::Address(skin->initial_norms_);
-				TSSkinMesh::init_transform_list_[i] = Vector::Address(skin->initial_transforms_);
-				TSSkinMesh::vertex_index_list_[i] = Vector::Address(skin->vertex_index_);
-				TSSkinMesh::bone_index_list_[i] = Vector::Address(skin->bone_index_);
-				TSSkinMesh::weight_list_[i] = Vector::Address(skin->weight_);
-				TSSkinMesh::node_index_list_[i] = Vector::Address(skin->node_index_);
+				alloc.verts_list_[i] = Vector::Address(skin->initial_verts_);
+				alloc.norms_list_[i] = Vector::Address(skin->initial_norms_);
+				alloc.init_transform_list_[i] = Vector::Address(skin->initial_transforms_);
+				alloc.vertex_index_list_[i] = Vector::Address(skin->vertex_index_);
+				alloc.bone_index_list_[i] = Vector::Address(skin->bone_index_);
+				alloc.weight_list_[i] = Vector::Address(skin->weight_);
+				alloc.node_index_list_[i] = Vector::Address(skin->node_index_);
 			}
 		}
 	}
-	Vector::Set(meshes_, ptrmesh, num_meshes);
-
-	tsalloc.CheckGuard();
-
-	// names
-	char* name_buffer_start = (char*)tsalloc.IMemBuffer8::GetPointer(0);
-	char* name = name_buffer_start;
-	int32_t name_buffer_size = 0;
-	names_.resize(num_names);
-	for (i = 0; i < num_names; i++)
-	{
-		for (j = 0; name[j]; j++)
-			;
-
-		names_[i] = name;
-		name_buffer_size += j + 1;
-		name += j + 1;
-	}
+	alloc.CheckGuard();
 
-	tsalloc.IMemBuffer8::GetPointer(name_buffer_size);
-	tsalloc.Align32();
+	// names, copied in one go
+	const char* name_buffer_start = reinterpret_cast<const char*>(alloc.IMemBuffer8::GetPointer(0));
+	int32_t name_buffer_size = names_.SetBlock(name_buffer_start, num_names);
+	alloc.IMemBuffer8::GetPointer(name_buffer_size);
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 
-	if (current_read_version_ < 23)
+	if (read_version < 23)
 	{
 		// get detail information about skins...
-		int32_t* det_first_skin = tsalloc.IMemBuffer32::GetPointer(num_details);
-		int32_t* detail_num_skins = tsalloc.IMemBuffer32::GetPointer(num_details);
+		int32_t* det_first_skin = alloc.IMemBuffer32::GetPointer(num_details);
+		int32_t* detail_num_skins = alloc.IMemBuffer32::GetPointer(num_details);
+
+		alloc.CheckGuard();
 
-		tsalloc.CheckGuard();
+		std::vector<bool> skip_skin(num_skins, options.skip_meshes);
+		for (i = 0; i < num_details; i++)
+		{
+			if (!IsDetailSkipped(i, options))
+				continue;
 
-		// skins
-		ptr32 = tsalloc.IMemBuffer32::AllocShape(num_skins);
+			for (j = std::max(det_first_skin[i], 0); j < det_first_skin[i] + detail_num_skins[i] && j < num_skins; j++)
+				skip_skin[j] = true;
+		}
+
+		// skins, added to the shapes list of meshes
 		for (i = 0; i < num_skins; i++)
 		{
-			bool skip = false;
-			TSSkinMesh* skin = reinterpret_cast<TSSkinMesh*>(TSMesh::AssembleMesh(TSMesh::kSkinMeshType, skip));
-			if (Vector::Address(meshes_))
+			if (skip_skin[i])
 			{
-				// add pointer to skin in shapes list of meshes
-				// we reserved room for this above...
-				Vector::Set(meshes_, Vector::Address(meshes_), meshes_.size() + 1);
-				meshes_[meshes_.size() - 1] = skip ? NULL : skin;
+				// read into a scratch mesh; i is a skin index, not a mesh
+				// index, so it mustn't be recorded in the mesh lists
+				TSMesh::AssembleMesh(alloc, TSMesh::kSkinMeshType, true);
+				meshes_.push_back(nullptr);
+				continue;
 			}
+			bool skip = false;
+			meshes_.push_back(TSMesh::AssembleMesh(alloc, TSMesh::kSkinMeshType, skip));
 		}
 
-		tsalloc.CheckGuard();
+		alloc.CheckGuard();
 	}
+
+	RebuildLookup();
+	InvalidateWorldTransforms();
+}
+
+bool TSShape::IsDetailSkipped(int32_t detail, const LoadOptions& options) const
+{
+	const Detail& det = details_[detail];
+	if (det.size < 0.0f)
+		return false; // collision and LOS details are always kept
+
+	if (options.max_detail_size > 0.0f && det.size > options.max_detail_size)
+		return true;
+	if (options.max_detail_polys > 0 && det.poly_count > options.max_detail_polys)
+		return true;
+
+	// rank amongst the visual details, 0 being the highest
+	int32_t rank = 0;
+	for (int32_t i = 0; i < static_cast<int32_t>(details_.size()); i++)
+	{
+		if (details_[i].size > det.size || (details_[i].size == det.size && i < detail))
+			rank++;
+	}
+	return rank < options.skip_details;
 }
 
-bool TSShape::LoadFromFile(const std::string& filename)
+bool TSShape::LoadFromFile(const std::string& filename, const LoadOptions& options)
 {
 	std::ifstream ifs(filename, std::ios::in | std::ios::binary);
 	if (!ifs.is_open())
@@ -458,34 +660,29 @@ bool TSShape::LoadFromFile(const std::string& filename)
 		return false;
 	}
 
-	return LoadFromStream(ifs);
+	return LoadFromStream(ifs, options);
 }
 
-bool TSShape::LoadFromStream(std::istream &is)
+bool TSShape::LoadFromStream(std::istream &is, const LoadOptions& options)
 {
 	IStream stream(is);
+	return LoadFromStream(stream, options);
+}
 
+bool TSShape::LoadFromMemory(const void* data, std::size_t size, const LoadOptions& options)
+{
+	IStream stream(data, size);
+	return LoadFromStream(stream, options);
+}
+
+bool TSShape::LoadFromStream(IStream& stream, const LoadOptions& options)
+{
 	// read version - read handles endian-flip
-	stream.Read(&current_read_version_);
-	exporter_version_ = current_read_version_ >> 16;
-	current_read_version_ &= 0xFF;
-	if (current_read_version_ > kVersion)
-	{
-		// error -- don't support future versions yet :>
+	int32_t version;
+	stream.Read(&version);
+	if (!SetReadVersion(version))
 		return false;
-	}
-	if (current_read_version_ < 19)
-	{
-		return false;
-	}
-	read_version_ = current_read_version_;
 
-	int32_t* mem_buffer32;
-	int16_t* mem_buffer16;
-	int8_t* mem_buffer8;
-	int32_t count32, count16, count8;
-
-	int32_t i;
 	uint32_t size_mem_buffer, startU16, startU8;
 
 	// in dwords. - read handles endian-flip
@@ -493,167 +690,371 @@ bool TSShape::LoadFromStream(std::istream &is)
 	stream.Read(&startU16);
 	stream.Read(&startU8);
 
-	int32_t* tmp = new int32_t[size_mem_buffer];
-	stream.Read(reinterpret_cast<uint8_t *>(tmp), sizeof(int32_t) * size_mem_buffer);
-	mem_buffer32 = tmp;
-	mem_buffer16 = reinterpret_cast<int16_t *>(tmp + startU16);
-	mem_buffer8 = reinterpret_cast<int8_t *>(tmp + startU8);
+	int32_t* mem_buffer32 = new int32_t[size_mem_buffer];
+	stream.Read(reinterpret_cast<uint8_t *>(mem_buffer32), sizeof(int32_t) * size_mem_buffer);
+
+	// since we read in the buffers, we need to endian-flip their entire contents...
+	FixEndian(mem_buffer32, reinterpret_cast<int16_t *>(mem_buffer32 + startU16), reinterpret_cast<int8_t *>(mem_buffer32 + startU8),
+		startU16, startU8 - startU16, size_mem_buffer - startU8);
+
+	LoadFromBuffers(stream, mem_buffer32, startU16, startU8, options);
+
+	// this covers all the buffers, which lazy meshes are still assembled from
+	if (lazy_alloc_)
+		lazy_buffer_ = mem_buffer32;
+	else
+		delete[] mem_buffer32;
+
+	return stream.Good();
+}
+
+bool TSShape::LoadFromMappedFile(const std::string& filename, const LoadOptions& options)
+{
+	MappedFile file;
+	if (!file.Open(filename))
+		return false;
+
+	// header: version, then buffer size and start of the 16 and 8 bit buffers (in dwords)
+	const std::size_t header_size = 4 * sizeof(int32_t);
+	if (file.GetSize() < header_size)
+		return false;
+
+	const int32_t* header = reinterpret_cast<const int32_t*>(file.GetData());
+	if (!SetReadVersion(ConvertLEndianToHost(header[0])))
+		return false;
+
+	uint32_t size_mem_buffer = ConvertLEndianToHost(static_cast<uint32_t>(header[1]));
+	uint32_t startU16 = ConvertLEndianToHost(static_cast<uint32_t>(header[2]));
+	uint32_t startU8 = ConvertLEndianToHost(static_cast<uint32_t>(header[3]));
+
+	std::size_t buffer_size = sizeof(int32_t) * size_mem_buffer;
+	if ((file.GetSize() - header_size) < buffer_size || startU16 > startU8 || startU8 > size_mem_buffer)
+		return false;
 
-	count32 = startU16;
-	count16 = startU8 - startU16;
-	count8 = size_mem_buffer - startU8;
+	// The buffers are assembled straight out of the mapping; only big endian
+	// hosts need a (writable) copy to endian-flip, and lazy meshes need a copy
+	// that outlives the mapping.
+	int32_t* mem_buffer32 = const_cast<int32_t*>(header + 4);
+	int32_t* copy = nullptr;
+	if (!IsLittleEndian() || options.lazy_meshes)
+	{
+		copy = new int32_t[size_mem_buffer];
+		memcpy(copy, mem_buffer32, buffer_size);
+		mem_buffer32 = copy;
+
+		FixEndian(mem_buffer32, reinterpret_cast<int16_t *>(mem_buffer32 + startU16), reinterpret_cast<int8_t *>(mem_buffer32 + startU8),
+			startU16, startU8 - startU16, size_mem_buffer - startU8);
+	}
+
+	// sequences and materials follow the buffers
+	IStream stream(file.GetData() + header_size + buffer_size, file.GetSize() - header_size - buffer_size);
+
+	LoadFromBuffers(stream, mem_buffer32, startU16, startU8, options);
+
+	if (lazy_alloc_)
+		lazy_buffer_ = copy;
+	else
+		delete[] copy;
+
+	return stream.Good();
+}
+
+bool TSShape::SetReadVersion(int32_t version)
+{
+	exporter_version_ = version >> 16;
+	version &= 0xFF;
+	if (version > kVersion)
+	{
+		// error -- don't support future versions yet :>
+		return false;
+	}
+	if (version < 19)
+	{
+		return false;
+	}
+	read_version_ = version;
+	return true;
+}
+
+void TSShape::LoadFromBuffers(IStream& stream, int32_t* mem_buffer32, uint32_t startU16, uint32_t startU8, const LoadOptions& options)
+{
+	int16_t* mem_buffer16 = reinterpret_cast<int16_t *>(mem_buffer32 + startU16);
+	int8_t* mem_buffer8 = reinterpret_cast<int8_t *>(mem_buffer32 + startU8);
 
 	// read sequences
 	int32_t num_sequences;
 	stream.Read(&num_sequences);
 	sequences_.resize(num_sequences);
-	for (i = 0; i < num_sequences; i++)
+	for (int32_t i = 0; i < num_sequences; i++)
 	{
-		sequences_[i].LoadFromStream(stream);
+		sequences_[i].LoadFromStream(stream, read_version_);
 	}
 
 	// read material list
 	delete material_list_; // just in case...
 	material_list_ = new TSMaterialList;
-	material_list_->LoadFromStream(stream);
+	material_list_->LoadFromStream(stream, read_version_);
+
+	// kept after the load if any meshes are assembled lazily
+	ITSShapeAlloc* alloc = new ITSShapeAlloc;
+	alloc->SetReadVersion(read_version_);
+	alloc->SetRead(mem_buffer32, mem_buffer16, mem_buffer8);
+	AssembleShape(*alloc, options); // allocates the shape's buffer for its meshes
+	shape_data_ = alloc->GetBuffer();
+	shape_data_size_ = alloc->GetSize();
+
+	if (lazy_meshes_.empty())
+		delete alloc;
+	else
+		lazy_alloc_ = alloc;
+}
 
-	// since we read in the buffers, we need to endian-flip their entire contents...
-	FixEndian(mem_buffer32, mem_buffer16, mem_buffer8, count32, count16, count8);
+TSMesh* TSShape::GetMesh(int32_t index)
+{
+	if (!meshes_[index] && lazy_alloc_ && lazy_meshes_[index].dest)
+	{
+		LazyMesh& lazy_mesh = lazy_meshes_[index];
+		lazy_alloc_->SetBuffer(lazy_mesh.dest);
+		lazy_alloc_->SetReadPosition(lazy_mesh.position);
+		if (cache_writes_ && read_version_ == kVersion)
+			meshes_[index] = AssembleCachedMesh(*lazy_alloc_, lazy_mesh.mesh_type);
+		else
+			meshes_[index] = TSMesh::AssembleMesh(*lazy_alloc_, lazy_mesh.mesh_type, false);
+		lazy_mesh.dest = nullptr;
+	}
+	return meshes_[index];
+}
 
-	tsalloc.SetRead(mem_buffer32, mem_buffer16, mem_buffer8, true);
-	AssembleShape(); // determine size of buffer needed
-	shape_data_size_ = tsalloc.GetSize();
-	tsalloc.DoAlloc();
-	shape_data_ = tsalloc.ITSShapeAlloc::GetBuffer();
-	tsalloc.SetRead(mem_buffer32, mem_buffer16, mem_buffer8, false);
-	AssembleShape(); // copy to buffer
-	assert(tsalloc.GetSize() == shape_data_size_);
+void TSShape::MaterializeMeshes()
+{
+	if (!lazy_alloc_)
+		return;
+
+	for (int32_t i = 0; i < static_cast<int32_t>(meshes_.size()); i++)
+		GetMesh(i);
+
+	// nothing left to assemble, so the read buffers can go
+	lazy_meshes_.clear();
+	delete lazy_alloc_;
+	lazy_alloc_ = nullptr;
+	delete[] lazy_buffer_;
+	lazy_buffer_ = nullptr;
+}
 
-	delete[] mem_buffer32; // this covers all the buffers
+void TSShape::SetWriteCaching(bool enable)
+{
+	cache_writes_ = enable;
+	if (enable)
+		return;
 
-	return is.good();
+	for (int32_t i = 0; i < static_cast<int32_t>(meshes_.size()); i++)
+	{
+		if (meshes_[i])
+			meshes_[i]->SetDirty();
+	}
 }
 
-void TSShape::DisassembleShape()
+void TSShape::GetWrittenMeshes(std::vector<TSMesh*>* meshes) const
 {
-	int32_t i;
+	// decals are pretend meshes (legacy issue), so only the objects' meshes
+	// are written
+	meshes->assign(meshes_.size(), nullptr);
+	for (int32_t i = 0; i < static_cast<int32_t>(objects_.size()); i++)
+	{
+		for (int32_t j = 0; j < objects_[i].num_meshes; j++)
+		{
+			int32_t mesh_index = objects_[i].start_mesh_index + j;
+			(*meshes)[mesh_index] = meshes_[mesh_index];
+		}
+	}
+}
+
+void TSShape::DisassembleShape(OTSShapeAlloc& alloc, int32_t threads)
+{
+	TSWorkerPool pool(threads);
+	std::vector<TSMesh*> meshes;
+	GetWrittenMeshes(&meshes);
+	UpdateWriteCaches(meshes, cache_writes_, pool);
+
+	// sized up front, so each buffer is allocated once
+	int32_t size32, size16, size8;
+	GetWriteSize(&size32, &size16, &size8);
+	size32 += alloc.OMemBuffer32::GetBufferSize();
+	size16 += alloc.OMemBuffer16::GetBufferSize();
+	size8 += alloc.OMemBuffer8::GetBufferSize();
+	alloc.Reserve(size32, size16, size8);
+
+	DisassembleShape(alloc, meshes, pool);
+	assert(alloc.OMemBuffer32::GetBufferSize() == size32);
+	assert(alloc.OMemBuffer16::GetBufferSize() == size16);
+	assert(alloc.OMemBuffer8::GetBufferSize() == size8);
+}
+
+void TSShape::DisassembleShape(OTSShapeAlloc& alloc, const std::vector<TSMesh*>& meshes, TSWorkerPool& pool)
+{
+	int32_t i, j;
 
 	// set counts...
-	int32_t num_nodes = tsalloc.OMemBuffer32::Set(nodes_.size());
-	int32_t num_objects = tsalloc.OMemBuffer32::Set(objects_.size());
-	tsalloc.OMemBuffer32::Set(0); // DEPRECATED decals
-	int32_t num_sub_shapes = tsalloc.OMemBuffer32::Set(sub_shape_first_node_.size());
-	tsalloc.OMemBuffer32::Set(0); // DEPRECATED ifl materials
-	int32_t num_node_rotations = tsalloc.OMemBuffer32::Set(node_rotations_.size());
-	int32_t num_node_translations = tsalloc.OMemBuffer32::Set(node_translations_.size());
-	int32_t num_node_uniform_scales = tsalloc.OMemBuffer32::Set(node_uniform_scales_.size());
-	int32_t num_node_aligned_scales = tsalloc.OMemBuffer32::Set(node_aligned_scales_.size());
-	int32_t num_node_arbitrary_scales = tsalloc.OMemBuffer32::Set(node_arbitrary_scale_factors_.size());
-	int32_t num_ground_frames = tsalloc.OMemBuffer32::Set(ground_translations_.size());
-	int32_t num_object_states = tsalloc.OMemBuffer32::Set(object_states_.size());
-	tsalloc.OMemBuffer32::Set(0); // DEPRECATED decals
-	int32_t num_triggers = tsalloc.OMemBuffer32::Set(triggers_.size());
-	int32_t num_details = tsalloc.OMemBuffer32::Set(details_.size());
-	int32_t num_meshes = tsalloc.OMemBuffer32::Set(meshes_.size());
-	int32_t num_names = tsalloc.OMemBuffer32::Set(names_.size());
-	tsalloc.OMemBuffer32::Set(static_cast<int32_t>(smallest_visible_size_));
-	tsalloc.OMemBuffer32::Set(smallest_visible_dl_);
-
-	tsalloc.SetGuard();
+	int32_t num_nodes = alloc.OMemBuffer32::Set(nodes_.size());
+	int32_t num_objects = alloc.OMemBuffer32::Set(objects_.size());
+	alloc.OMemBuffer32::Set(0); // DEPRECATED decals
+	int32_t num_sub_shapes = alloc.OMemBuffer32::Set(sub_shape_first_node_.size());
+	alloc.OMemBuffer32::Set(0); // DEPRECATED ifl materials
+	int32_t num_node_rotations = alloc.OMemBuffer32::Set(node_rotations_.size());
+	int32_t num_node_translations = alloc.OMemBuffer32::Set(node_translations_.size());
+	int32_t num_node_uniform_scales = alloc.OMemBuffer32::Set(node_uniform_scales_.size());
+	int32_t num_node_aligned_scales = alloc.OMemBuffer32::Set(node_aligned_scales_.size());
+	int32_t num_node_arbitrary_scales = alloc.OMemBuffer32::Set(node_arbitrary_scale_factors_.size());
+	int32_t num_ground_frames = alloc.OMemBuffer32::Set(ground_translations_.size());
+	int32_t num_object_states = alloc.OMemBuffer32::Set(object_states_.size());
+	alloc.OMemBuffer32::Set(0); // DEPRECATED decals
+	int32_t num_triggers = alloc.OMemBuffer32::Set(triggers_.size());
+	int32_t num_details = alloc.OMemBuffer32::Set(details_.size());
+	int32_t num_meshes = alloc.OMemBuffer32::Set(meshes_.size());
+	alloc.OMemBuffer32::Set(names_.Size());
+	alloc.OMemBuffer32::Set(static_cast<int32_t>(smallest_visible_size_));
+	alloc.OMemBuffer32::Set(smallest_visible_dl_);
+
+	alloc.SetGuard();
 
 	// get bounds...
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(&radius_), 1);
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(&tube_radius_), 1);
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(&center_), 3);
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(&bounds_), 6);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(&radius_), 1);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(&tube_radius_), 1);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(&center_), 3);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(&bounds_), 6);
 
-	tsalloc.SetGuard();
+	alloc.SetGuard();
 
 	// copy various vectors...
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(nodes_)), num_nodes * 5);
-	tsalloc.SetGuard();
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(objects_)), num_objects * 6);
-	tsalloc.SetGuard();
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(nodes_)), num_nodes * 5);
+	alloc.SetGuard();
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(objects_)), num_objects * 6);
+	alloc.SetGuard();
 	// DEPRECATED: no copy decals
-	tsalloc.SetGuard();
-	tsalloc.OMemBuffer32::CopyToBuffer(0, 0); // DEPRECATED: ifl materials!
-	tsalloc.SetGuard();
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(sub_shape_first_node_)), num_sub_shapes);
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(sub_shape_first_object_)), num_sub_shapes);
-	tsalloc.OMemBuffer32::CopyToBuffer(0, num_sub_shapes); // DEPRECATED: no copy sub_shape_first_decal_
-	tsalloc.SetGuard();
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(sub_shape_num_nodes_)), num_sub_shapes);
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(sub_shape_num_objects_)), num_sub_shapes);
-	tsalloc.OMemBuffer32::CopyToBuffer(0, num_sub_shapes); // DEPRECATED: no copy sub_shape_num_decals_
-	tsalloc.SetGuard();
+	alloc.SetGuard();
+	alloc.OMemBuffer32::CopyToBuffer(0, 0); // DEPRECATED: ifl materials!
+	alloc.SetGuard();
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(sub_shape_first_node_)), num_sub_shapes);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(sub_shape_first_object_)), num_sub_shapes);
+	alloc.OMemBuffer32::CopyToBuffer(0, num_sub_shapes); // DEPRECATED: no copy sub_shape_first_decal_
+	alloc.SetGuard();
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(sub_shape_num_nodes_)), num_sub_shapes);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(sub_shape_num_objects_)), num_sub_shapes);
+	alloc.OMemBuffer32::CopyToBuffer(0, num_sub_shapes); // DEPRECATED: no copy sub_shape_num_decals_
+	alloc.SetGuard();
 
 	// default transforms...
-	tsalloc.OMemBuffer16::CopyToBuffer(reinterpret_cast<int16_t*>(Vector::Address(default_rotations_)), num_nodes * 4);
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(default_translations_)), num_nodes * 3);
+	alloc.OMemBuffer16::CopyToBuffer(reinterpret_cast<int16_t*>(Vector::Address(default_rotations_)), num_nodes * 4);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(default_translations_)), num_nodes * 3);
 
 	// animated transforms...
-	tsalloc.OMemBuffer16::CopyToBuffer(reinterpret_cast<int16_t*>(Vector::Address(node_rotations_)), num_node_rotations * 4);
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(node_translations_)), num_node_translations * 3);
+	alloc.OMemBuffer16::CopyToBuffer(reinterpret_cast<int16_t*>(Vector::Address(node_rotations_)), num_node_rotations * 4);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(node_translations_)), num_node_translations * 3);
 
-	tsalloc.SetGuard();
+	alloc.SetGuard();
 
 	// ...with scale
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(node_uniform_scales_)), num_node_uniform_scales);
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(node_aligned_scales_)), num_node_aligned_scales * 3);
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(node_arbitrary_scale_factors_)), num_node_arbitrary_scales * 3);
-	tsalloc.OMemBuffer16::CopyToBuffer(reinterpret_cast<int16_t*>(Vector::Address(node_arbitrary_scale_rots_)), num_node_arbitrary_scales * 4);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(node_uniform_scales_)), num_node_uniform_scales);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(node_aligned_scales_)), num_node_aligned_scales * 3);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(node_arbitrary_scale_factors_)), num_node_arbitrary_scales * 3);
+	alloc.OMemBuffer16::CopyToBuffer(reinterpret_cast<int16_t*>(Vector::Address(node_arbitrary_scale_rots_)), num_node_arbitrary_scales * 4);
 
-	tsalloc.SetGuard();
+	alloc.SetGuard();
 
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(ground_translations_)), num_ground_frames * 3);
-	tsalloc.OMemBuffer16::CopyToBuffer(reinterpret_cast<int16_t*>(Vector::Address(ground_rotations_)), num_ground_frames * 4);
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(ground_translations_)), num_ground_frames * 3);
+	alloc.OMemBuffer16::CopyToBuffer(reinterpret_cast<int16_t*>(Vector::Address(ground_rotations_)), num_ground_frames * 4);
 
-	tsalloc.SetGuard();
+	alloc.SetGuard();
 
 	// object states..
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(object_states_)), num_object_states * 3);
-	tsalloc.SetGuard();
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(object_states_)), num_object_states * 3);
+	alloc.SetGuard();
 
 	// decal states...
 	// DEPRECATED (num_decal_states = 0)
-	tsalloc.SetGuard();
+	alloc.SetGuard();
 
 	// frame triggers
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(triggers_)), num_triggers * 2);
-	tsalloc.SetGuard();
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(triggers_)), num_triggers * 2);
+	alloc.SetGuard();
 
 	// details
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(details_)), num_details * 7);
-	tsalloc.SetGuard();
-
-	// read in the meshes (sans skins)...
-	bool* is_mesh = new bool[num_meshes]; // funny business because decals are pretend meshes (legacy issue)
-	for (i = 0; i < num_meshes; i++)
-		is_mesh[i] = false;
-	for (i = 0; i < objects_.size(); i++)
-	{
-		for (int32_t j = 0; j < objects_[i].num_meshes; j++)
-			// even if an empty mesh, it's a mesh...
-			is_mesh[objects_[i].start_mesh_index + j] = true;
-	}
-	for (i = 0; i < num_meshes; i++)
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(details_)), num_details * 7);
+	alloc.SetGuard();
+
+	// the meshes (sans skins), each preceded by its type.  Those without a
+	// write cache are disassembled a window at a time, and each window is
+	// spliced in and freed before the next, so only a few are ever held.
+	const int32_t window = pool.GetNumThreads();
+	std::vector<OTSShapeAlloc> fragments(window);
+	for (i = 0; i < num_meshes; i += window)
 	{
-		TSMesh* mesh = NULL;
-		// decal mesh deprecated
-		if (is_mesh[i])
-			mesh = meshes_[i];
-		tsalloc.OMemBuffer32::Set((mesh && mesh->GetMeshType() != TSMesh::kDecalMeshType) ? mesh->GetMeshType() : TSMesh::kNullMeshType);
-		if (mesh)
-			mesh->Disassemble();
+		const int32_t count = std::min(window, num_meshes - i);
+		pool.Run(count, [&](int32_t k)
+		{
+			TSMesh* mesh = meshes[i + k];
+			if (mesh && !mesh->GetWriteCache())
+			{
+				fragments[k].SetFragmentOf(alloc);
+				mesh->DisassembleFragment(fragments[k]);
+			}
+		});
+
+		for (j = 0; j < count; j++)
+		{
+			TSMesh* mesh = meshes[i + j];
+			// decal mesh deprecated
+			alloc.OMemBuffer32::Set((mesh && mesh->GetMeshType() != TSMesh::kDecalMeshType) ? mesh->GetMeshType() : TSMesh::kNullMeshType);
+			if (mesh)
+				alloc.Splice(mesh->GetWriteCache() ? *mesh->GetWriteCache() : fragments[j]);
+			fragments[j].SetWrite();
+		}
 	}
-	delete[] is_mesh;
-	tsalloc.SetGuard();
+	alloc.SetGuard();
 
 	// names
-	for (i = 0; i < num_names; i++)
-		tsalloc.OMemBuffer8::CopyToBuffer(reinterpret_cast<const int8_t*>(names_[i].c_str()), names_[i].length() + 1);
+	alloc.OMemBuffer8::CopyToBuffer(reinterpret_cast<const int8_t*>(names_.GetBlock()), names_.GetBlockSize());
 
-	tsalloc.SetGuard();
+	alloc.SetGuard();
+}
+
+void TSShape::GetWriteSize(int32_t* size32, int32_t* size16, int32_t* size8) const
+{
+	const int32_t kNumGuards = 17;
+	const int32_t num_nodes = nodes_.size();
+	const int32_t num_sub_shapes = sub_shape_first_node_.size();
+	const int32_t num_node_arbitrary_scales = node_arbitrary_scale_factors_.size();
+	const int32_t num_ground_frames = ground_translations_.size();
+
+	// counts, bounds and the fixed size arrays...
+	*size32 = kNumGuards + 19 + 11;
+	*size32 += num_nodes * 5 + objects_.size() * 6 + num_sub_shapes * 6;
+	*size32 += num_nodes * 3 + node_translations_.size() * 3;
+	*size32 += node_uniform_scales_.size() + node_aligned_scales_.size() * 3 + num_node_arbitrary_scales * 3;
+	*size32 += num_ground_frames * 3 + object_states_.size() * 3 + triggers_.size() * 2 + details_.size() * 7;
+	*size16 = kNumGuards + (num_nodes + node_rotations_.size() + num_node_arbitrary_scales + num_ground_frames) * 4;
+	*size8 = kNumGuards;
+
+	// ...the meshes, each preceded by its type...
+	std::vector<TSMesh*> meshes;
+	GetWrittenMeshes(&meshes);
+	*size32 += meshes.size();
+	for (std::size_t i = 0; i < meshes.size(); i++)
+	{
+		const TSMesh* mesh = meshes[i];
+		const OTSShapeAlloc* cache = mesh ? mesh->GetWriteCache() : nullptr;
+		if (cache)
+		{
+			*size32 += cache->OMemBuffer32::GetBufferSize();
+			*size16 += cache->OMemBuffer16::GetBufferSize();
+			*size8 += cache->OMemBuffer8::GetBufferSize();
+		}
+		else if (mesh)
+			mesh->AddWriteSize(size32, size16, size8);
+	}
+
+	// ...and the names
+	*size8 += names_.GetBlockSize();
 }
 
 void TSShape::FixEndian(int32_t* buff32, int16_t* buff16, int8_t*, int32_t count32, int32_t count16, int32_t)
@@ -668,7 +1069,7 @@ void TSShape::FixEndian(int32_t* buff32, int16_t* buff16, int8_t*, int32_t count
 	}
 }
 
-bool TSShape::WriteToFile(const std::string& filename)
+bool TSShape::WriteToFile(const std::string& filename, int32_t threads)
 {
 	std::ofstream ofs(filename, std::ios::out | std::ios::binary);
 	if (!ofs.is_open())
@@ -676,66 +1077,71 @@ bool TSShape::WriteToFile(const std::string& filename)
 		return false;
 	}
 
-	return WriteToStream(ofs);
+	return WriteToStream(ofs, threads);
 }
 
-bool TSShape::WriteToStream(std::ostream &os)
+bool TSShape::WriteToStream(std::ostream &os, int32_t threads)
 {
-	OStream stream(os);
+	MaterializeMeshes();
 
-	// write version
-	stream.Write(kVersion | (kMostRecentExporterVersion << 16));
+	TSWorkerPool pool(threads);
+	std::vector<TSMesh*> meshes;
+	GetWrittenMeshes(&meshes);
+	UpdateWriteCaches(meshes, cache_writes_, pool);
 
-	tsalloc.SetWrite();
-	DisassembleShape();
+	// the header needs the section sizes before any of the sections
+	int32_t size32, size16, size8;
+	GetWriteSize(&size32, &size16, &size8);
 
-	int32_t* buffer32 = tsalloc.OMemBuffer32::GetBuffer();
-	int16_t* buffer16 = tsalloc.OMemBuffer16::GetBuffer();
-	int8_t* buffer8 = tsalloc.OMemBuffer8::GetBuffer();
+	OStream stream(os);
 
-	int32_t size32 = tsalloc.OMemBuffer32::GetBufferSize();
-	int32_t size16 = tsalloc.OMemBuffer16::GetBufferSize();
-	int32_t size8 = tsalloc.OMemBuffer8::GetBufferSize();
+	// write version
+	stream.Write(kVersion | (kMostRecentExporterVersion << 16));
 
 	// convert sizes to dwords...
-	if (size16 & 1)
-		size16 += 2;
-	size16 >>= 1;
-	if (size8 & 3)
-		size8 += 4;
-	size8 >>= 2;
+	int32_t dwords16 = (size16 + 1) >> 1;
+	int32_t dwords8 = (size8 + 3) >> 2;
 
 	int32_t size_mem_buffer, start16, start8;
-	size_mem_buffer = size32 + size16 + size8;
+	size_mem_buffer = size32 + dwords16 + dwords8;
 	start16 = size32;
-	start8 = start16 + size16;
+	start8 = start16 + dwords16;
 
 	// in dwords -- write will properly endian-flip.
 	stream.Write(size_mem_buffer);
 	stream.Write(start16);
 	stream.Write(start8);
+	if (!stream.Flush())
+		return false;
 
-	// endian-flip the entire write buffers.
-	FixEndian(buffer32, buffer16, buffer8, size32, size16, size8);
+	// Stream the sections in order, one pass each.  A pass keeps a chunk of
+	// the section it writes and a window of mesh fragments, whose other two
+	// sections are only counted, so memory use doesn't grow with the shape.
+	OTSShapeAlloc alloc;
+	alloc.SetStream(&os, nullptr, nullptr);
+	DisassembleShape(alloc, meshes, pool);
+	if (!alloc.FinishStream() || alloc.OMemBuffer32::GetBufferSize() != size32)
+		return false;
 
-	// now write buffers
-	stream.Write(buffer32, size32 * 4);
-	stream.Write(buffer16, size16 * 4);
-	stream.Write(buffer8, size8 * 4);
+	alloc.SetStream(nullptr, &os, nullptr);
+	DisassembleShape(alloc, meshes, pool);
+	if (!alloc.FinishStream() || alloc.OMemBuffer16::GetBufferSize() != size16)
+		return false;
+
+	alloc.SetStream(nullptr, nullptr, &os);
+	DisassembleShape(alloc, meshes, pool);
+	if (!alloc.FinishStream() || alloc.OMemBuffer8::GetBufferSize() != size8)
+		return false;
 
 	// write sequences - write will properly endian-flip.
-	stream.Write(sequences_.size());
+	stream.Write(static_cast<int32_t>(sequences_.size()));
 	for (int32_t i = 0; i < sequences_.size(); i++)
 		sequences_[i].WriteToStream(stream);
 
 	// write material list - write will properly endian-flip.
 	material_list_->WriteToStream(stream);
 
-	delete[] buffer32;
-	delete[] buffer16;
-	delete[] buffer8;
-
-	return os.good();
+	return stream.Flush();
 }
 
 } // namespace DTS
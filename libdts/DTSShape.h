@@ -1,14 +1,18 @@
 #ifndef DTS_SHAPE_H_
 #define DTS_SHAPE_H_
 
+#include <mutex>
+
 #include "DTSMesh.h"
 #include "DTSIntegerSet.h"
+#include "DTSNamePool.h"
 #include "DTSShapeAlloc.h"
 
 namespace DTS
 {
 
 class TSMaterialList;
+class TSWorkerPool;
 
 // TSShape stores generic data for a 3space model.
 class TSShape
@@ -55,9 +59,19 @@ public:
 	{
 	public:
 		// IO
-		bool LoadFromStream(IStream& is, bool read_name_index = true);
+		bool LoadFromStream(IStream& is, int32_t read_version, bool read_name_index = true);
 		bool WriteToStream(OStream& os, bool write_name_index = true);
 
+		// The keyframes either side of time seconds in, and how far it is
+		// from key1 to key2.  Cyclic sequences wrap round, others stop at
+		// their ends.
+		void SelectKeyframes(float time, int32_t* key1, int32_t* key2, float* key_pos) const
+		{
+			SelectKeyframes(time, duration_, num_keyframes_, (flags_ & kCyclic) != 0, key1, key2, key_pos);
+		}
+		static void SelectKeyframes(float time, float duration, int32_t num_keyframes, bool cyclic,
+			int32_t* key1, int32_t* key2, float* key_pos);
+
 		int32_t name_index_;
 		int32_t num_keyframes_;
 		float duration_;
@@ -118,11 +132,34 @@ public:
 		int32_t poly_count;
 	};
 
+	// Options controlling what gets assembled when a shape is loaded.  Meshes
+	// that aren't assembled are left as nullptr in meshes_.  Collision and
+	// LOS details (those with a negative size) are never dropped.
+	struct LoadOptions
+	{
+		LoadOptions() :
+			skip_meshes(false), lazy_meshes(false), skip_details(0), max_detail_size(0.0f), max_detail_polys(0),
+			cache_writes(false) {}
+
+		bool skip_meshes;			// skip every mesh, e.g. when only the rest of the shape is wanted
+		bool lazy_meshes;			// assemble meshes the first time GetMesh asks for them
+		int32_t skip_details;		// drop this many of the highest visual details
+		float max_detail_size;		// drop visual details larger than this, 0 for no limit
+		int32_t max_detail_polys;	// drop visual details with more polys than this, 0 for no limit
+		bool cache_writes;			// keep each mesh as read, see SetWriteCaching
+	};
+
+	// A mesh loaded with LoadOptions::lazy_meshes that hasn't been assembled yet
+	struct LazyMesh
+	{
+		uint32_t mesh_type;
+		ITSShapeAlloc::ReadPosition position;
+		int8_t* dest; // room kept for it in shape_data_, nullptr once assembled
+	};
+
 	// Version Info
 	// Most recent version...the one we write
 	static const int32_t kVersion;
-	// Version currently being read, only valid during read
-	static int32_t current_read_version_;
 	static const int32_t kMostRecentExporterVersion;
 
 	// constructor/destructor
@@ -135,33 +172,109 @@ public:
 	// Returns index into the name vector that equals the passed name.
 	int32_t FindName(const std::string& name) const;
 
+	// Node and object lookups go through an index that the editing methods
+	// keep up to date.  It is rebuilt when names_, nodes_ or objects_ change
+	// size behind its back; any other direct edit of them needs a RebuildLookup().
+	void RebuildLookup() const;
+
 	int32_t FindNode(int32_t name_index) const;
 	int32_t FindNode(const std::string& name) const { return FindNode(FindName(name)); }
 
 	int32_t FindObject(int32_t name_index) const;
 	int32_t FindObject(const std::string& name) const { return FindObject(FindName(name)); }
 
+	int32_t FindSequence(const std::string& name) const;
+
 	int32_t GetSubShapeForNode(int32_t node_index);
 	int32_t GetSubShapeForObject(int32_t obj_index);
 	void GetSubShapeDetails(int32_t sub_shape_index, std::vector<int32_t>& valid_details);
+	void GetSubShapeObjects(int32_t sub_shape_index, std::vector<int32_t>& objects);
 
+	// World transforms are kept once worked out, so asking for every node's
+	// costs one pass down the tree.  The editing methods drop those they
+	// change; any direct edit of nodes_ or the default transforms needs an
+	// InvalidateWorldTransforms().  The cache is locked, so a shape that
+	// isn't being edited can be read from several threads.
 	void GetNodeWorldTransform(int32_t node_index, MatrixF* mat) const;
+	void InvalidateWorldTransforms() const;
+	void InvalidateWorldTransform(int32_t node_index) const; // and those below it
+
+	// Animation
+
+	// Poses every node time seconds into a sequence, relative to its parent.
+	// Only the nodes the sequence animates are interpolated; the rest keep
+	// their default transform.  A blend sequence's keys are relative to its
+	// reference pose and come back as they are.  False for a bad index, or
+	// a sequence whose keys run past the shape's.
+	bool SampleSequence(int32_t seq_index, float time, std::vector<MatrixF>* local_transforms) const;
+	// The same, key_pos of the way from keyframe key1 to key2
+	bool SampleKeyframes(int32_t seq_index, int32_t key1, int32_t key2, float key_pos, std::vector<MatrixF>* local_transforms) const;
+
+	// Composes each node's transform relative to its parent into one
+	// relative to the shape.  Parents come before their children.
+	void GetWorldTransforms(const std::vector<MatrixF>& local_transforms, std::vector<MatrixF>* world_transforms) const;
+
+	// Meshes loaded with LoadOptions::lazy_meshes are left as nullptr in
+	// meshes_ until they're asked for here.  MaterializeMeshes assembles any
+	// still pending and has to be called before meshes_ is edited directly.
+	TSMesh* GetMesh(int32_t index);
+	void MaterializeMeshes();
 
 	// Methods for saving/loading shapes to/from streams
-	bool LoadFromFile(const std::string& filename);
-	bool LoadFromStream(std::istream& is);
-
-	bool WriteToFile(const std::string& filename);
-	bool WriteToStream(std::ostream& os);
+	bool LoadFromFile(const std::string& filename, const LoadOptions& options = LoadOptions());
+	bool LoadFromStream(std::istream& is, const LoadOptions& options = LoadOptions());
+	// Loads from a whole shape file already in memory
+	bool LoadFromMemory(const void* data, std::size_t size, const LoadOptions& options = LoadOptions());
+
+	// Memory maps the file and assembles the shape straight from the mapping
+	bool LoadFromMappedFile(const std::string& filename, const LoadOptions& options = LoadOptions());
+
+	// threads > 1 disassembles the meshes in parallel, 0 uses one per core.
+	// The sections are streamed out a pass each, holding only a chunk of
+	// the section and a few meshes at a time, so meshes without a write
+	// cache are disassembled once per pass.
+	bool WriteToFile(const std::string& filename, int32_t threads = 1);
+	bool WriteToStream(std::ostream& os, int32_t threads = 1);
+
+	// While on, every mesh keeps its serialized form from the load or the
+	// last save (see TSMesh::SetDirty), so saving again only disassembles the
+	// meshes that changed.  Turning it off drops what was kept.  The shape's
+	// own tables aren't cached: they're written as straight copies of their
+	// vectors, so there is nothing to save by keeping them.
+	void SetWriteCaching(bool enable);
 
 	// Persist Helper Functions
+	bool SetReadVersion(int32_t version);
+	bool LoadFromStream(IStream& stream, const LoadOptions& options);
+	void LoadFromBuffers(IStream& stream, int32_t* mem_buffer32, uint32_t startU16, uint32_t startU8, const LoadOptions& options);
+	bool IsDetailSkipped(int32_t detail, const LoadOptions& options) const;
 	void FixEndian(int32_t* buff32, int16_t* buff16, int8_t*, int32_t count32, int32_t count16, int32_t);
 
 	//  Memory Buffer Transfer Methods
-	void AssembleShape();
-	void DisassembleShape();
+	void AssembleShape(ITSShapeAlloc& alloc, const LoadOptions& options = LoadOptions());
+	void DisassembleShape(OTSShapeAlloc& alloc, int32_t threads = 1);
+	void GetWriteSize(int32_t* size32, int32_t* size16, int32_t* size8) const; // entries DisassembleShape writes
+
+	// The mesh written in each slot of meshes_, nullptr where none is.  A
+	// slot that several objects share is still only one mesh.
+	void GetWrittenMeshes(std::vector<TSMesh*>* meshes) const;
+	// Writes the shape with each mesh from its write cache if it has one,
+	// else disassembled on pool a window at a time
+	void DisassembleShape(OTSShapeAlloc& alloc, const std::vector<TSMesh*>& meshes, TSWorkerPool& pool);
 
 	// Shape Editing
+
+	// Between BeginEdit and CommitEdit, AddNode and AddObject append to nodes_
+	// and objects_ instead of inserting at the end of their sub-shape, and
+	// meshes are added to a list per object instead of meshes_, so that the
+	// index fixups for all of them are done once, by CommitEdit.  Until then
+	// node and object indices refer to that appended order, and meshes_ (with
+	// the objects' start_mesh_index) is as it was at BeginEdit.  Edits nest;
+	// only the outermost CommitEdit applies them.
+	void BeginEdit();
+	void CommitEdit();
+	bool IsEditing() const { return edit_depth_ > 0; }
+
 	int32_t AddName(const std::string& name);
 	void UpdateSmallestVisibleDL();
 	int32_t AddDetail(const std::string& dname, int32_t size, int32_t sub_shape_num);
@@ -176,7 +289,28 @@ public:
 	TSMesh* CopyMesh(const TSMesh* src_mesh) const;
 	bool AddMesh(TSMesh* mesh, const std::string& mesh_name);
 
-	static TSShapeAlloc alloc_;
+	// Removing something drops what goes with it: a node's animation keys
+	// (its children, objects and skin bones move to its parent), an object's
+	// meshes and states, a detail's meshes, a sequence's keys, ground frames
+	// and triggers, and any object left without meshes.  Names only they
+	// used go too.  Each is a single pass over the shape, and none can be
+	// done during an edit.
+	bool RemoveNode(const std::string& name);
+	bool RemoveObject(const std::string& name);
+	bool RemoveMesh(const std::string& mesh_name);
+	bool RemoveDetail(int32_t size);
+	bool RemoveSequence(const std::string& name);
+
+	// Drops the names and animation keys nothing refers to, and the meshes
+	// no object can show: those no object owns, those past the details of
+	// their object's sub-shape, and trailing nullptrs.
+	void Compact();
+
+	// What a removal drops, by index; ApplyRemoval drops whatever goes with
+	// it and fixes up every index into what is left
+	struct RemoveSet;
+	void ApplyRemoval(RemoveSet& set);
+	void DeleteMesh(TSMesh* mesh);
 
 	// TSShape Vector Data
 	std::vector<Node> nodes_;
@@ -202,7 +336,7 @@ public:
 	std::vector<Quat16> ground_rotations_;
 	std::vector<Point3F> ground_translations_;
 	std::vector<Trigger> triggers_;
-	std::vector<std::string> names_;
+	TSNamePool names_;
 
 	TSMaterialList* material_list_;
 
@@ -218,8 +352,39 @@ public:
 	int32_t smallest_visible_dl_;
 	int32_t read_version_; // File version that this shape was read from.
 
-	int8_t* shape_data_;
+	int8_t* shape_data_; // meshes assembled at load are constructed in here
 	uint32_t shape_data_size_;
+
+	// Lazily assembled meshes, along with the read buffers (and the alloc
+	// that points into them) that they're assembled from.  Only set while
+	// any are still pending.
+	std::vector<LazyMesh> lazy_meshes_;
+	ITSShapeAlloc* lazy_alloc_;
+	int32_t* lazy_buffer_;
+
+	bool cache_writes_;
+
+	// Edit in progress (see BeginEdit): the node and object counts it began
+	// with, the sub-shape of each node and object appended since, and the
+	// meshes of every object
+	int32_t edit_depth_;
+	int32_t edit_num_nodes_, edit_num_objects_;
+	std::vector<int32_t> edit_node_sub_shapes_;
+	std::vector<int32_t> edit_object_sub_shapes_;
+	std::vector<std::vector<TSMesh*>> edit_meshes_;
+
+	// Lookup index (see RebuildLookup), from name indices to the first
+	// node/object with that name; names_ indexes itself
+	void UpdateLookup() const;
+	mutable std::vector<int32_t> node_lookup_;
+	mutable std::vector<int32_t> object_lookup_;
+	mutable std::size_t lookup_names_, lookup_nodes_, lookup_objects_; // sizes the index was built for
+
+	// World transform of each node, where world_valid_ (only ever set for a
+	// node whose parent has it set too)
+	mutable std::vector<MatrixF> world_transforms_;
+	mutable std::vector<bool> world_valid_;
+	mutable std::mutex world_mutex_;
 };
 
 } // namespace DTS
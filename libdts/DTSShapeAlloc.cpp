@@ -5,35 +5,54 @@
 namespace DTS
 {
 
-void ITSShapeAlloc::SetRead(int32_t* buff32, int16_t* buff16, int8_t* buff8, bool clear)
+void ITSShapeAlloc::SetRead(int32_t* buff32, int16_t* buff16, int8_t* buff8)
 {
 	IMemBuffer32::SetRead(buff32);
 	IMemBuffer16::SetRead(buff16);
 	IMemBuffer8::SetRead(buff8);
 
-	if (clear)
-	{
-		dest_ = nullptr;
-		size_ = 0;
-	}
+	buffer_ = dest_ = nullptr;
+	size_ = 0;
 
 	SetSkipMode(false);
 }
 
-void ITSShapeAlloc::DoAlloc()
+ITSShapeAlloc::ReadPosition ITSShapeAlloc::GetReadPosition() const
+{
+	ReadPosition position;
+	position.buff32 = IMemBuffer32::GetCursor();
+	position.buff16 = IMemBuffer16::GetCursor();
+	position.buff8 = IMemBuffer8::GetCursor();
+	position.guard32 = IMemBuffer32::GetGuard();
+	position.guard16 = IMemBuffer16::GetGuard();
+	position.guard8 = IMemBuffer8::GetGuard();
+	return position;
+}
+
+void ITSShapeAlloc::SetReadPosition(const ReadPosition& position)
+{
+	IMemBuffer32::SetRead(position.buff32, position.guard32);
+	IMemBuffer16::SetRead(position.buff16, position.guard16);
+	IMemBuffer8::SetRead(position.buff8, position.guard8);
+}
+
+void ITSShapeAlloc::SetBuffer(int8_t* buffer)
 {
-	dest_ = new int8_t[size_];
+	buffer_ = dest_ = buffer;
 	size_ = 0;
 }
 
-void ITSShapeAlloc::Align32()
+void ITSShapeAlloc::DoAlloc(int32_t size)
 {
-	int32_t aligned = size_ + 3 & (~0x3);
-	IMemBuffer8::AllocShape(aligned - size_);
+	buffer_ = dest_ = new int8_t[size];
+	size_ = 0;
 }
 
 void ITSShapeAlloc::CheckGuard()
 {
+	if (guard_log_)
+		guard_log_->push_back(GetReadPosition());
+
 	bool check32 = IMemBuffer32::CheckGuard();
 	bool check16 = IMemBuffer16::CheckGuard();
 	bool check8 = IMemBuffer8::CheckGuard();
@@ -42,6 +61,19 @@ void ITSShapeAlloc::CheckGuard()
 	assert(check8);
 }
 
+void ITSShapeAlloc::ClearMeshLists(int32_t count)
+{
+	verts_list_.assign(count, nullptr);
+	tverts_list_.assign(count, nullptr);
+	norms_list_.assign(count, nullptr);
+	encoded_norms_list_.assign(count, nullptr);
+	init_transform_list_.assign(count, nullptr);
+	vertex_index_list_.assign(count, nullptr);
+	bone_index_list_.assign(count, nullptr);
+	weight_list_.assign(count, nullptr);
+	node_index_list_.assign(count, nullptr);
+}
+
 void OTSShapeAlloc::SetWrite()
 {
 	OMemBuffer32::SetWrite();
@@ -49,6 +81,58 @@ void OTSShapeAlloc::SetWrite()
 	OMemBuffer8::SetWrite();
 }
 
+void OTSShapeAlloc::Reserve(int32_t size32, int32_t size16, int32_t size8)
+{
+	OMemBuffer32::Reserve(size32);
+	OMemBuffer16::Reserve(size16);
+	OMemBuffer8::Reserve(size8);
+}
+
+void OTSShapeAlloc::SetStream(std::ostream* os32, std::ostream* os16, std::ostream* os8)
+{
+	OMemBuffer32::SetStream(os32);
+	OMemBuffer16::SetStream(os16);
+	OMemBuffer8::SetStream(os8);
+}
+
+bool OTSShapeAlloc::FinishStream()
+{
+	bool ok32 = OMemBuffer32::FinishStream();
+	bool ok16 = OMemBuffer16::FinishStream();
+	bool ok8 = OMemBuffer8::FinishStream();
+	return ok32 && ok16 && ok8;
+}
+
+void OTSShapeAlloc::SetFragmentOf(const OTSShapeAlloc& alloc)
+{
+	OMemBuffer32::SetFragmentOf(alloc);
+	OMemBuffer16::SetFragmentOf(alloc);
+	OMemBuffer8::SetFragmentOf(alloc);
+}
+
+void OTSShapeAlloc::Splice(const OTSShapeAlloc& fragment)
+{
+	OMemBuffer32::Splice(fragment);
+	OMemBuffer16::Splice(fragment);
+	OMemBuffer8::Splice(fragment);
+}
+
+void OTSShapeAlloc::SetFragment(const ITSShapeAlloc::ReadPosition& start, const ITSShapeAlloc::ReadPosition& end,
+	const std::vector<ITSShapeAlloc::ReadPosition>& guards)
+{
+	std::vector<int32_t> guards32, guards16, guards8;
+	for (std::size_t i = 0; i < guards.size(); i++)
+	{
+		guards32.push_back(static_cast<int32_t>(guards[i].buff32 - start.buff32));
+		guards16.push_back(static_cast<int32_t>(guards[i].buff16 - start.buff16));
+		guards8.push_back(static_cast<int32_t>(guards[i].buff8 - start.buff8));
+	}
+
+	OMemBuffer32::SetFragment(start.buff32, static_cast<int32_t>(end.buff32 - start.buff32), guards32);
+	OMemBuffer16::SetFragment(start.buff16, static_cast<int32_t>(end.buff16 - start.buff16), guards16);
+	OMemBuffer8::SetFragment(start.buff8, static_cast<int32_t>(end.buff8 - start.buff8), guards8);
+}
+
 void OTSShapeAlloc::SetGuard()
 {
 	OMemBuffer32::SetGuard();
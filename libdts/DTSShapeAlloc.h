@@ -1,11 +1,22 @@
 #ifndef DTS_SHAPEALLOC_H_
 #define DTS_SHAPEALLOC_H_
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+#include "DTSEndian.h"
+#include "DTSVector.h"
 
 namespace DTS
 {
 
+class Point2F;
+class Point3F;
+class MatrixF;
+
 // Alloc structure used in the reading/writing of shapes.
 class IMemBufferBase
 {
@@ -27,13 +38,17 @@ public:
 	IMemBuffer() :
 		mem_buffer_(nullptr), mem_guard_(0), save_guard_(0) {}
 
-	void SetRead(T* buff)
+	void SetRead(T* buff, T guard = 0)
 	{
 		mem_buffer_ = buff;
-		mem_guard_ = 0;
+		mem_guard_ = guard;
 		save_guard_ = 0;
 	}
 
+	// current read position and next expected guard
+	T* GetCursor() const { return mem_buffer_; }
+	T GetGuard() const { return mem_guard_; }
+
 	// reads one or more entries of type from input buffer(doesn't affect output buffer)
 	T Get()
 	{
@@ -46,21 +61,6 @@ public:
 		mem_buffer_ += num;
 	}
 
-	// copies entries of type from input buffer to output buffer
-	T* CopyToShape(int32_t num, bool return_something = false)
-	{
-		T* ret = (!return_something || dest_) ? reinterpret_cast<T*>(dest_) : mem_buffer_;
-		if (dest_)
-		{
-			memcpy(dest_, reinterpret_cast<int8_t*>(mem_buffer_),
-				mult_ * num * sizeof(T));
-			dest_ += mult_ * num * sizeof(T);
-		}
-		mem_buffer_ += num;
-		size_ += sizeof(T) * mult_ * num;
-		return ret;
-	}
-
 	// gets pointer to next entries of type in input buffer (no effect on input buffer)
 	T* GetPointer(int32_t num)
 	{
@@ -97,66 +97,196 @@ using IMemBuffer32 = IMemBuffer<int32_t>;
 using IMemBuffer16 = IMemBuffer<int16_t>;
 using IMemBuffer8 = IMemBuffer<int8_t>;
 
+// Read side of the alloc structure.  One of these is created per load, so
+// separate shapes can be assembled on separate threads at the same time.
 class ITSShapeAlloc : public IMemBuffer32, public IMemBuffer16, public IMemBuffer8
 {
 public:
-	void SetRead(int32_t* buff32, int16_t* buff16, int8_t* buff8, bool clear);
+	ITSShapeAlloc() :
+		buffer_(nullptr), read_version_(-1), guard_log_(nullptr) {}
+
+	void SetRead(int32_t* buff32, int16_t* buff16, int8_t* buff8);
 
-	void DoAlloc();
-	void Align32(); // align on dword boundary
-	int8_t* GetBuffer() { return dest_; }
+	// Position in all three read buffers, so reading can be picked up again later
+	struct ReadPosition
+	{
+		int32_t* buff32;
+		int16_t* buff16;
+		int8_t* buff8;
+		int32_t guard32;
+		int16_t guard16;
+		int8_t guard8;
+	};
+	ReadPosition GetReadPosition() const;
+	void SetReadPosition(const ReadPosition& position);
+
+	// The shape's buffer only holds its meshes, everything else is read
+	// straight from the input buffers
+	void DoAlloc(int32_t size);
+	void SetBuffer(int8_t* buffer); // assemble into room allocated elsewhere
+	int8_t* GetBuffer() { return buffer_; }
 	int32_t GetSize() { return size_; }
 	void SetSkipMode(bool skip) { mult_ = skip ? 0 : 1; }
 
 	void CheckGuard();
+
+	// While set, where each guard is read from gets added to log
+	void SetGuardLog(std::vector<ReadPosition>* log) { guard_log_ = log; }
+
+	// Version of the shape being read
+	int32_t GetReadVersion() const { return read_version_; }
+	void SetReadVersion(int32_t version) { read_version_ = version; }
+
+	// Clears the structures used to share data between detail levels
+	void ClearMeshLists(int32_t count);
+
+	// structures used to share data between detail levels...
+	// used (and valid) during load only
+	std::vector<Point3F*>	verts_list_;
+	std::vector<Point3F*>	norms_list_;
+	std::vector<uint8_t*>	encoded_norms_list_;
+	std::vector<Point2F*>	tverts_list_;
+
+	std::vector<MatrixF*>	init_transform_list_;
+	std::vector<int32_t*>	vertex_index_list_;
+	std::vector<int32_t*>	bone_index_list_;
+	std::vector<float*>		weight_list_;
+	std::vector<int32_t*>	node_index_list_;
+
+private:
+	int8_t* buffer_;
+	int32_t read_version_;
+	std::vector<ReadPosition>* guard_log_;
 };
 
 template <typename T>
 class OMemBuffer
 {
 public:
-	static const int32_t kPageSize = 1024;	// PageSize must be multiple of 4 so that we can always
-											// "over-read" up to next dword
+	static const int32_t kPageSize = 1024;	// smallest allocation; buffers are always sized to a multiple of 4
+											// so that we can "over-read" up to next dword
+
+	static const int32_t kChunkSize = 4096;	// entries held back before a streamed buffer is flushed
 
-	OMemBuffer::OMemBuffer()
-		: mem_buffer_(nullptr), size_(0), full_size_(0), mem_guard_(0) {}
+	OMemBuffer()
+		: size_(0), full_size_(0), mem_guard_(0), streaming_(false), stream_(nullptr), flushed_(0) {}
 
 	void SetWrite()
 	{
-		mem_buffer_ = nullptr;
+		std::vector<T>().swap(mem_buffer_);
 		size_ = full_size_ = 0;
 		mem_guard_ = 0;
+		streaming_ = false;
+		stream_ = nullptr;
+		flushed_ = 0;
+		guards_.clear();
 	}
 
+	// Instead of keeping the entries, write them to os (little endian) through
+	// a chunk of kChunkSize entries.  With a null os they are only counted.
+	void SetStream(std::ostream* os)
+	{
+		SetWrite();
+		streaming_ = true;
+		stream_ = os;
+		if (stream_)
+		{
+			full_size_ = kChunkSize;
+			mem_buffer_.resize(full_size_);
+		}
+	}
+
+	// Flushes what is left of a streamed buffer and pads it out to the next dword
+	bool FinishStream()
+	{
+		if (!stream_)
+			return true;
+
+		int32_t pad = static_cast<int32_t>((4 - (size_ * sizeof(T)) % 4) % 4 / sizeof(T));
+		Append(nullptr, pad);
+		Flush();
+		size_ -= pad;
+		return stream_->good();
+	}
+
+	// still owned by the buffer
 	T* GetBuffer()
 	{
-		return mem_buffer_;
+		return Vector::Address(mem_buffer_);
 	}
 
-	int32_t GetBufferSize()
+	int32_t GetBufferSize() const
 	{
 		return size_;
 	}
 
 	void SetGuard()
 	{
+		if (!streaming_)
+			guards_.push_back(size_);
 		Set(mem_guard_);
 		mem_guard_++;
 	}
 
-	T* Extend(int32_t add)
+	// Sets up a buffer that a part of other's output can be written to on its
+	// own and then spliced into it.  It counts if other does, else it keeps
+	// its entries in memory.
+	void SetFragmentOf(const OMemBuffer& other)
 	{
-		if (size_ + add > full_size_)
+		if (other.streaming_ && !other.stream_)
+			SetStream(nullptr);
+		else
+			SetWrite();
+	}
+
+	// Appends a fragment's entries as if they had been written here, moving
+	// its guards on to follow ours
+	void Splice(const OMemBuffer& fragment)
+	{
+		int32_t start = 0;
+		for (std::size_t i = 0; i < fragment.guards_.size(); i++)
 		{
-			int32_t num_pages = 1 + (full_size_ + add) / kPageSize;
-			full_size_ = num_pages * kPageSize;
-			T* temp = new T[full_size_];
-			memcpy(temp, mem_buffer_, size_ * sizeof(T));
-			delete[] mem_buffer_;
-			mem_buffer_ = temp;
+			int32_t guard = fragment.guards_[i];
+			CopyToBuffer(Vector::Address(fragment.mem_buffer_) + start, guard - start);
+			if (!streaming_)
+				guards_.push_back(size_);
+			Set(static_cast<T>(fragment.mem_buffer_[guard] + mem_guard_));
+			start = guard + 1;
 		}
+		CopyToBuffer(fragment.mem_buffer_.empty() ? nullptr : Vector::Address(fragment.mem_buffer_) + start, fragment.size_ - start);
+		mem_guard_ += fragment.mem_guard_;
+	}
 
-		T* ret = mem_buffer_ + size_;
+	// Fills a fragment with count entries read back in.  guards are the
+	// offsets of the guards among them, which get numbered from 0.
+	void SetFragment(const T* entries, int32_t count, const std::vector<int32_t>& guards)
+	{
+		SetWrite();
+		CopyToBuffer(entries, count);
+		guards_ = guards;
+		for (std::size_t i = 0; i < guards_.size(); i++)
+			mem_buffer_[guards_[i]] = mem_guard_++;
+	}
+
+	// makes room for count entries in total without further allocation;
+	// streamed buffers only ever hold a chunk
+	void Reserve(int32_t count)
+	{
+		if (streaming_ || count <= full_size_)
+			return;
+
+		// zeroed, so the padding up to the next dword is too
+		full_size_ = (count + 3) & ~3;
+		mem_buffer_.resize(full_size_);
+	}
+
+	T* Extend(int32_t add)
+	{
+		// grow geometrically so that writing n entries costs O(n)
+		if (size_ + add > full_size_)
+			Reserve(std::max(std::max(size_ + add, 2 * full_size_), kPageSize));
+
+		T* ret = Vector::Address(mem_buffer_) + size_;
 		size_ += add;
 		return ret;
 	}
@@ -164,34 +294,96 @@ public:
 	//adds one entry to buffer
 	T Set(T entry)
 	{
-		*Extend(1) = entry;
+		if (streaming_)
+			Append(&entry, 1);
+		else
+			*Extend(1) = entry;
 		return entry;
 	}
 
 	// adds count entries to buffer
 	void CopyToBuffer(const T* entries, int32_t count)
 	{
-		if (entries)
+		if (streaming_)
+			Append(entries, count);
+		else if (entries)
 			memcpy(Extend(count), entries, count * sizeof(T));
 		else
 			memset(Extend(count), 0, count * sizeof(T));
 	}
 
 private:
-	T* mem_buffer_;
+	// streamed write, null entries are zeros
+	void Append(const T* entries, int32_t count)
+	{
+		if (!stream_)
+		{
+			size_ += count;
+			return;
+		}
+
+		while (count > 0)
+		{
+			int32_t used = size_ - flushed_;
+			int32_t num = std::min(count, full_size_ - used);
+			if (entries)
+			{
+				memcpy(Vector::Address(mem_buffer_) + used, entries, num * sizeof(T));
+				entries += num;
+			}
+			else
+				memset(Vector::Address(mem_buffer_) + used, 0, num * sizeof(T));
+
+			size_ += num;
+			count -= num;
+			if (size_ - flushed_ == full_size_)
+				Flush();
+		}
+	}
+
+	void Flush()
+	{
+		int32_t used = size_ - flushed_;
+		for (int32_t i = 0; i < used; i++)
+			mem_buffer_[i] = ConvertHostToLEndian(mem_buffer_[i]);
+		stream_->write(reinterpret_cast<const char*>(Vector::Address(mem_buffer_)), used * sizeof(T));
+		flushed_ = size_;
+	}
+
+	std::vector<T> mem_buffer_;	// full_size_ entries, zeroed past what was written
 	int32_t size_;
 	int32_t full_size_;
 	T mem_guard_;
+
+	bool streaming_;
+	std::ostream* stream_;
+	int32_t flushed_;	// entries already written to stream_
+	std::vector<int32_t> guards_;	// where the guards are, when kept in memory
 };
 
 using OMemBuffer32 = OMemBuffer<int32_t>;
 using OMemBuffer16 = OMemBuffer<int16_t>;
 using OMemBuffer8 = OMemBuffer<int8_t>;
 
+// Write side of the alloc structure, one per save.
 class OTSShapeAlloc : public OMemBuffer32, public OMemBuffer16, public OMemBuffer8
 {
 public:
 	void SetWrite();
+	void Reserve(int32_t size32, int32_t size16, int32_t size8);
+
+	// streams each buffer to its own ostream, a null ostream only counts
+	void SetStream(std::ostream* os32, std::ostream* os16, std::ostream* os8);
+	bool FinishStream();
+
+	// for writing parts of the output separately, see OMemBuffer
+	void SetFragmentOf(const OTSShapeAlloc& alloc);
+	void Splice(const OTSShapeAlloc& fragment);
+
+	// Fills a fragment with what was read between start and end, guards
+	// being where the reader found the guards in between
+	void SetFragment(const ITSShapeAlloc::ReadPosition& start, const ITSShapeAlloc::ReadPosition& end,
+		const std::vector<ITSShapeAlloc::ReadPosition>& guards);
 
 	void SetGuard();
 };
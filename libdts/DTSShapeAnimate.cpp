@@ -0,0 +1,201 @@
+#include "DTSShape.h"
+
+#include <cmath>
+
+namespace DTS
+{
+
+namespace
+{
+
+Point3F Lerp(const Point3F& a, const Point3F& b, float t)
+{
+	return a + (b - a) * t;
+}
+
+// The number of nodes in a matters set, one key row each
+int32_t CountRows(const TSIntegerSet& set, int32_t num_nodes)
+{
+	int32_t count = 0;
+	for (int32_t i = set.Start(); i >= 0 && i < num_nodes; i = set.Next(i))
+		count++;
+	return count;
+}
+
+// Whether rows of num_keyframes keys starting at base lie within size keys
+bool RowsFit(int32_t base, int32_t rows, int32_t num_keyframes, std::size_t size)
+{
+	if (rows == 0)
+		return true;
+	return base >= 0 && static_cast<int64_t>(base) + static_cast<int64_t>(rows) * num_keyframes <= static_cast<int64_t>(size);
+}
+
+// Slerps count key rows in one go
+void SlerpRows(const std::vector<Quat16>& keys, int32_t base, int32_t num_keyframes, int32_t key1, int32_t key2, float key_pos, std::vector<QuatF>* rots, int32_t count)
+{
+	rots->resize(count);
+	if (count)
+		SlerpQuats(&keys[base + key1], &keys[base + key2], num_keyframes, key_pos, &(*rots)[0], count);
+}
+
+} // namespace
+
+void TSShape::Sequence::SelectKeyframes(float time, float duration, int32_t num_keyframes, bool cyclic,
+	int32_t* key1, int32_t* key2, float* key_pos)
+{
+	float pos = duration > 0.0f ? time / duration : 0.0f;
+	if (cyclic)
+		pos -= floorf(pos);
+	else if (pos < 0.0f)
+		pos = 0.0f;
+	else if (pos > 1.0f)
+		pos = 1.0f;
+
+	// a cyclic sequence's last key blends back into its first
+	int32_t num_spans = cyclic ? num_keyframes : num_keyframes - 1;
+	if (num_spans <= 0)
+	{
+		*key1 = *key2 = 0;
+		*key_pos = 0.0f;
+		return;
+	}
+
+	float key = pos * num_spans;
+	int32_t span = static_cast<int32_t>(key);
+	if (span >= num_spans)
+		span = num_spans - 1; // the very end
+
+	*key1 = span;
+	*key2 = (span + 1 == num_keyframes) ? 0 : span + 1;
+	*key_pos = key - span;
+}
+
+bool TSShape::SampleSequence(int32_t seq_index, float time, std::vector<MatrixF>* local_transforms) const
+{
+	if (seq_index < 0 || seq_index >= static_cast<int32_t>(sequences_.size()))
+		return false;
+
+	int32_t key1, key2;
+	float key_pos;
+	sequences_[seq_index].SelectKeyframes(time, &key1, &key2, &key_pos);
+	return SampleKeyframes(seq_index, key1, key2, key_pos, local_transforms);
+}
+
+bool TSShape::SampleKeyframes(int32_t seq_index, int32_t key1, int32_t key2, float key_pos, std::vector<MatrixF>* local_transforms) const
+{
+	if (seq_index < 0 || seq_index >= static_cast<int32_t>(sequences_.size()))
+		return false;
+
+	const Sequence& seq = sequences_[seq_index];
+	const int32_t num_keyframes = seq.num_keyframes_;
+	if (key1 < 0 || key1 >= num_keyframes || key2 < 0 || key2 >= num_keyframes)
+		return false;
+
+	int32_t num_nodes = static_cast<int32_t>(nodes_.size());
+
+	// the sequence's key rows have to lie within the shape's keys
+	int32_t rotation_rows = CountRows(seq.rotation_matters_, num_nodes);
+	int32_t translation_rows = CountRows(seq.translation_matters_, num_nodes);
+	int32_t scale_rows = CountRows(seq.scale_matters_, num_nodes);
+	if (!RowsFit(seq.base_rotation_, rotation_rows, num_keyframes, node_rotations_.size()) ||
+		!RowsFit(seq.base_translation_, translation_rows, num_keyframes, node_translations_.size()))
+		return false;
+
+	if (scale_rows)
+	{
+		bool scales_fit;
+		if (seq.flags_ & kArbitraryScale)
+			scales_fit = RowsFit(seq.base_scale_, scale_rows, num_keyframes, node_arbitrary_scale_rots_.size()) &&
+				RowsFit(seq.base_scale_, scale_rows, num_keyframes, node_arbitrary_scale_factors_.size());
+		else if (seq.flags_ & kAlignedScale)
+			scales_fit = RowsFit(seq.base_scale_, scale_rows, num_keyframes, node_aligned_scales_.size());
+		else if (seq.flags_ & kUniformScale)
+			scales_fit = RowsFit(seq.base_scale_, scale_rows, num_keyframes, node_uniform_scales_.size());
+		else
+			scales_fit = false; // scale keys of no kind
+		if (!scales_fit)
+			return false;
+	}
+
+	// Rotation keys are slerped all at once, rather than a node at a time
+	std::vector<QuatF> rotations, scale_rotations;
+	SlerpRows(node_rotations_, seq.base_rotation_, num_keyframes, key1, key2, key_pos, &rotations, rotation_rows);
+	if (seq.flags_ & kArbitraryScale)
+		SlerpRows(node_arbitrary_scale_rots_, seq.base_scale_, num_keyframes, key1, key2, key_pos, &scale_rotations, scale_rows);
+
+	// Each animated node has a row of num_keyframes keys, in node order,
+	// so walk the set bits alongside the nodes, counting off the rows
+	int32_t rotation = seq.rotation_matters_.Start();
+	int32_t translation = seq.translation_matters_.Start();
+	int32_t scale = seq.scale_matters_.Start();
+	int32_t rotation_row = 0;
+	int32_t translation_row = 0;
+	int32_t scale_row = 0;
+
+	local_transforms->resize(num_nodes);
+	for (int32_t i = 0; i < num_nodes; i++)
+	{
+		MatrixF& mat = (*local_transforms)[i];
+
+		if (i == rotation)
+		{
+			rotations[rotation_row++].SetMatrix(&mat);
+			rotation = seq.rotation_matters_.Next(rotation);
+		}
+		else
+			default_rotations_[i].GetQuatF().SetMatrix(&mat);
+
+		if (i == translation)
+		{
+			int32_t keys = seq.base_translation_ + translation_row++ * num_keyframes;
+			mat.SetPosition(Lerp(node_translations_[keys + key1], node_translations_[keys + key2], key_pos));
+			translation = seq.translation_matters_.Next(translation);
+		}
+		else
+			mat.SetPosition(default_translations_[i]);
+
+		if (i == scale)
+		{
+			int32_t keys = seq.base_scale_ + scale_row * num_keyframes;
+			if (seq.flags_ & kArbitraryScale)
+			{
+				// scaled along the axes of its own rotation: M * R * S * R^-1
+				MatrixF rot;
+				scale_rotations[scale_row].SetMatrix(&rot);
+				mat.Mul(rot);
+				mat.Scale(Lerp(node_arbitrary_scale_factors_[keys + key1], node_arbitrary_scale_factors_[keys + key2], key_pos));
+				mat.Mul(rot.Transpose());
+			}
+			else if (seq.flags_ & kAlignedScale)
+				mat.Scale(Lerp(node_aligned_scales_[keys + key1], node_aligned_scales_[keys + key2], key_pos));
+			else if (seq.flags_ & kUniformScale)
+			{
+				float s1 = node_uniform_scales_[keys + key1];
+				float s2 = node_uniform_scales_[keys + key2];
+				float s = s1 + (s2 - s1) * key_pos;
+				mat.Scale(Point3F(s, s, s));
+			}
+			scale = seq.scale_matters_.Next(scale);
+			scale_row++;
+		}
+	}
+
+	return true;
+}
+
+void TSShape::GetWorldTransforms(const std::vector<MatrixF>& local_transforms, std::vector<MatrixF>* world_transforms) const
+{
+	int32_t num_nodes = static_cast<int32_t>(nodes_.size());
+	world_transforms->resize(num_nodes);
+	for (int32_t i = 0; i < num_nodes; i++)
+	{
+		int32_t parent_index = nodes_[i].parent_index;
+		assert(parent_index < i);
+		if (parent_index == -1)
+			(*world_transforms)[i] = local_transforms[i];
+		else
+			(*world_transforms)[i].Mul((*world_transforms)[parent_index], local_transforms[i]);
+	}
+}
+
+} // namespace DTS
@@ -144,6 +144,7 @@ bool TSShapeConstructor::AddCollisionDetail(int32_t size, CollisionDetailType ty
 	}
 
 	// Add the meshes to the shape
+	shape_->BeginEdit();
 	for (int32_t i = 0; i < fit.GetMeshCount(); i++)
 	{
 		MeshFit::Mesh* mesh = fit.GetMesh(i);
@@ -178,6 +179,7 @@ bool TSShapeConstructor::AddCollisionDetail(int32_t size, CollisionDetailType ty
 			shape_->SetObjectNode(obj_name, mesh_name);
 		}
 	}
+	shape_->CommitEdit();
 
 	return true;
 }
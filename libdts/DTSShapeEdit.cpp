@@ -1,10 +1,288 @@
 #include "DTSShape.h"
 
+#include <algorithm>
+
 #include "DTSString.h"
 
 namespace DTS
 {
 
+namespace
+{
+
+// Moves a name index -> item index lookup along for an item inserted at index
+template<typename T>
+void InsertIntoLookup(std::vector<int32_t>& lookup, const std::vector<T>& items, int32_t index)
+{
+	// from the back, so an entry is only moved along with the item it names
+	for (int32_t i = static_cast<int32_t>(items.size()) - 1; i > index; i--)
+	{
+		int32_t name_index = items[i].name_index;
+		if (name_index >= 0 && name_index < static_cast<int32_t>(lookup.size()) && lookup[name_index] == i - 1)
+			lookup[name_index] = i;
+	}
+
+	int32_t name_index = items[index].name_index;
+	if (name_index >= 0 && name_index < static_cast<int32_t>(lookup.size()) && (lookup[name_index] < 0 || lookup[name_index] > index))
+		lookup[name_index] = index;
+}
+
+// Moves items[i] to items[new_index[i]]
+template<typename T>
+void Permute(std::vector<T>& items, const std::vector<int32_t>& new_index)
+{
+	std::vector<T> moved(items.size());
+	for (std::size_t i = 0; i < items.size(); i++)
+		moved[new_index[i]] = std::move(items[i]);
+	items.swap(moved);
+}
+
+// Works out where the num_kept items an edit began with, and the ones it
+// appended (one sub-shape each), go once every appended item is moved to the
+// end of its sub-shape, and grows the sub-shape ranges to match.  Returns
+// whether any item moves.
+bool OrderBySubShape(std::vector<int32_t>& first, std::vector<int32_t>& count, int32_t num_kept,
+	const std::vector<int32_t>& appended_sub_shapes, std::vector<int32_t>& new_index)
+{
+	int32_t i, j;
+
+	std::vector<std::vector<int32_t>> appended(first.size());
+	for (i = 0; i < static_cast<int32_t>(appended_sub_shapes.size()); i++)
+	{
+		if (appended_sub_shapes[i] >= 0 && appended_sub_shapes[i] < static_cast<int32_t>(appended.size()))
+			appended[appended_sub_shapes[i]].push_back(num_kept + i);
+	}
+
+	new_index.assign(num_kept + appended_sub_shapes.size(), -1);
+	int32_t next = 0;
+	for (i = 0; i < static_cast<int32_t>(first.size()); i++)
+	{
+		int32_t start = next;
+		for (j = first[i]; j < first[i] + count[i]; j++)
+			new_index[j] = next++;
+		for (j = 0; j < static_cast<int32_t>(appended[i].size()); j++)
+			new_index[appended[i][j]] = next++;
+
+		first[i] = start;
+		count[i] = next - start;
+	}
+
+	// anything outside the sub-shapes keeps its order, after them
+	bool moved = false;
+	for (i = 0; i < static_cast<int32_t>(new_index.size()); i++)
+	{
+		if (new_index[i] < 0)
+			new_index[i] = next++;
+		moved |= (new_index[i] != i);
+	}
+	return moved;
+}
+
+// Drops the items marked, in one pass
+template<typename T>
+void EraseMarked(std::vector<T>& items, const std::vector<bool>& drop)
+{
+	std::size_t count = 0;
+	for (std::size_t i = 0; i < items.size(); i++)
+	{
+		if (i < drop.size() && drop[i])
+			continue;
+		if (count != i)
+			items[count] = std::move(items[i]);
+		count++;
+	}
+	items.resize(count);
+}
+
+// Number of items before each index (and in all, at the end) that aren't
+// marked; the new index of those that are kept
+std::vector<int32_t> KeptBefore(const std::vector<bool>& drop)
+{
+	std::vector<int32_t> kept(drop.size() + 1);
+	int32_t count = 0;
+	for (std::size_t i = 0; i < drop.size(); i++)
+	{
+		kept[i] = count;
+		if (!drop[i])
+			count++;
+	}
+	kept[drop.size()] = count;
+	return kept;
+}
+
+// New index of each item, -1 for those dropped
+std::vector<int32_t> NewIndices(const std::vector<bool>& drop, const std::vector<int32_t>& kept_before)
+{
+	std::vector<int32_t> new_index(drop.size());
+	for (std::size_t i = 0; i < drop.size(); i++)
+		new_index[i] = drop[i] ? -1 : kept_before[i];
+	return new_index;
+}
+
+void KeepRange(std::vector<bool>& drop, int32_t start, int32_t count)
+{
+	int32_t end = std::min(start + count, static_cast<int32_t>(drop.size()));
+	for (int32_t i = std::max(start, 0); i < end; i++)
+		drop[i] = false;
+}
+
+// A sequence keeps a row of keys for each member of matters, in order;
+// keeps those of the members that are kept
+void KeepRows(std::vector<bool>& drop, const TSIntegerSet& matters, int32_t base, int32_t num_keyframes, const std::vector<int32_t>& new_index)
+{
+	int32_t row = 0;
+	for (int32_t i = 0; i < static_cast<int32_t>(new_index.size()); i++)
+	{
+		if (!matters.Test(i))
+			continue;
+		if (new_index[i] >= 0)
+			KeepRange(drop, base + row * num_keyframes, num_keyframes);
+		row++;
+	}
+}
+
+// Where a sequence's keys start once the ones dropped are gone
+void RebaseKeys(int32_t& base, const std::vector<int32_t>& kept_before)
+{
+	int32_t size = static_cast<int32_t>(kept_before.size()) - 1;
+	base = kept_before[std::min(std::max(base, 0), size)];
+}
+
+} // namespace
+
+struct TSShape::RemoveSet
+{
+	RemoveSet(const TSShape& shape) :
+		nodes(shape.nodes_.size(), false), objects(shape.objects_.size(), false), meshes(shape.meshes_.size(), false),
+		details(shape.details_.size(), false), sequences(shape.sequences_.size(), false), unused_names(false) {}
+
+	std::vector<bool> nodes;
+	std::vector<bool> objects;
+	std::vector<bool> meshes;		// slots of meshes_, erased from their object
+	std::vector<bool> details;
+	std::vector<bool> sequences;
+	bool unused_names;				// every name nothing uses, not just those the rest used
+};
+
+void TSShape::BeginEdit()
+{
+	if (edit_depth_++ > 0)
+		return;
+
+	MaterializeMeshes(); // the meshes move to the objects' lists
+
+	edit_num_nodes_ = static_cast<int32_t>(nodes_.size());
+	edit_num_objects_ = static_cast<int32_t>(objects_.size());
+
+	edit_meshes_.resize(objects_.size());
+	for (int32_t i = 0; i < static_cast<int32_t>(objects_.size()); i++)
+	{
+		std::vector<TSMesh*>::const_iterator start = meshes_.begin() + objects_[i].start_mesh_index;
+		edit_meshes_[i].assign(start, start + objects_[i].num_meshes);
+	}
+}
+
+void TSShape::CommitEdit()
+{
+	if (!IsEditing() || --edit_depth_ > 0)
+		return;
+
+	int32_t i, j;
+	std::vector<int32_t> new_index;
+
+	// Move the appended nodes to the end of their subshapes
+	if (OrderBySubShape(sub_shape_first_node_, sub_shape_num_nodes_, edit_num_nodes_, edit_node_sub_shapes_, new_index))
+	{
+		Permute(nodes_, new_index);
+		Permute(default_translations_, new_index);
+		Permute(default_rotations_, new_index);
+
+		// Fixup node indices
+		for (i = 0; i < static_cast<int32_t>(nodes_.size()); i++)
+		{
+			if (nodes_[i].parent_index >= 0)
+				nodes_[i].parent_index = new_index[nodes_[i].parent_index];
+		}
+		for (i = 0; i < static_cast<int32_t>(objects_.size()); i++)
+		{
+			if (objects_[i].node_index >= 0)
+				objects_[i].node_index = new_index[objects_[i].node_index];
+		}
+		for (i = 0; i < static_cast<int32_t>(edit_meshes_.size()); i++)
+		{
+			for (j = 0; j < static_cast<int32_t>(edit_meshes_[i].size()); j++)
+			{
+				TSMesh* mesh = edit_meshes_[i][j];
+				if (!mesh || (mesh->GetMeshType() != TSMesh::kSkinMeshType))
+					continue;
+
+				TSSkinMesh* skin = dynamic_cast<TSSkinMesh*>(mesh);
+				for (int32_t k = 0; k < static_cast<int32_t>(skin->node_index_.size()); k++)
+				{
+					int32_t node_index = skin->node_index_[k];
+					if (node_index >= 0 && new_index[node_index] != node_index)
+					{
+						skin->node_index_[k] = new_index[node_index];
+						skin->SetDirty();
+					}
+				}
+			}
+		}
+
+		// Update animation matters arrays (new nodes are not animated)
+		for (i = 0; i < static_cast<int32_t>(sequences_.size()); i++)
+		{
+			TSShape::Sequence& seq = sequences_[i];
+			seq.translation_matters_.Remap(&new_index[0], edit_num_nodes_);
+			seq.rotation_matters_.Remap(&new_index[0], edit_num_nodes_);
+			seq.scale_matters_.Remap(&new_index[0], edit_num_nodes_);
+		}
+	}
+
+	// Likewise the appended objects
+	int32_t num_new_objects = static_cast<int32_t>(edit_object_sub_shapes_.size());
+	if (OrderBySubShape(sub_shape_first_object_, sub_shape_num_objects_, edit_num_objects_, edit_object_sub_shapes_, new_index))
+	{
+		Permute(objects_, new_index);
+		Permute(edit_meshes_, new_index);
+	}
+
+	// Add default object states, in front of those of the sequences
+	if (num_new_objects > 0)
+	{
+		TSShape::ObjectState state;
+		state.frame_index = 0;
+		state.mat_frame_index = 0;
+		state.vis = 1.0f;
+
+		int32_t num_defaults = std::min(edit_num_objects_, static_cast<int32_t>(object_states_.size()));
+		std::vector<ObjectState> states(objects_.size(), state);
+		for (i = 0; i < num_defaults; i++)
+			states[new_index[i]] = object_states_[i];
+		states.insert(states.end(), object_states_.begin() + num_defaults, object_states_.end());
+		object_states_.swap(states);
+
+		// Fixup sequences
+		for (i = 0; i < static_cast<int32_t>(sequences_.size()); i++)
+			sequences_[i].base_object_state_ += num_new_objects;
+	}
+
+	// Lay the meshes out again, in object order
+	meshes_.clear();
+	for (i = 0; i < static_cast<int32_t>(objects_.size()); i++)
+	{
+		objects_[i].start_mesh_index = static_cast<int32_t>(meshes_.size());
+		meshes_.insert(meshes_.end(), edit_meshes_[i].begin(), edit_meshes_[i].end());
+	}
+
+	edit_node_sub_shapes_.clear();
+	edit_object_sub_shapes_.clear();
+	edit_meshes_.clear();
+
+	RebuildLookup();
+	InvalidateWorldTransforms();
+}
+
 int32_t TSShape::AddName(const std::string& name)
 {
 	// Check for empty names
@@ -12,12 +290,16 @@ int32_t TSShape::AddName(const std::string& name)
 		return -1;
 
 	// Return the index of the new name (add if it is unique)
-	int32_t index = FindName(name);
+	UpdateLookup();
+	int32_t index = names_.Find(name);
 	if (index >= 0)
 		return index;
 
-	names_.push_back(name);
-	return names_.size() - 1;
+	index = names_.Add(name);
+	node_lookup_.push_back(-1);
+	object_lookup_.push_back(-1);
+	lookup_names_ = names_.Size();
+	return index;
 }
 
 void TSShape::UpdateSmallestVisibleDL()
@@ -96,6 +378,7 @@ bool TSShape::SetNodeTransform(const std::string& name, const Point3F& pos, cons
 	}
 
 	// Update initial node position and rotation
+	InvalidateWorldTransform(node_index);
 	default_translations_[node_index] = pos;
 	default_rotations_[node_index].Set(rot);
 
@@ -127,23 +410,32 @@ bool TSShape::AddNode(const std::string& name, const std::string& parent_name, c
 		}
 	}
 
-	// Insert node at the end of the subshape
+	// Insert node at the end of the subshape (appended, while editing)
 	int32_t sub_shape_index = (parent_index >= 0) ? GetSubShapeForNode(parent_index) : 0;
-	int32_t node_index = sub_shape_num_nodes_[sub_shape_index];
+	int32_t node_index;
+	if (IsEditing())
+	{
+		node_index = static_cast<int32_t>(nodes_.size());
+		edit_node_sub_shapes_.push_back(sub_shape_index);
+	}
+	else
+	{
+		node_index = sub_shape_num_nodes_[sub_shape_index];
 
-	// Adjust subshape node indices
-	sub_shape_num_nodes_[sub_shape_index]++;
-	for (int32_t i = sub_shape_index + 1; i < sub_shape_first_node_.size(); i++)
-		sub_shape_first_node_[i]++;
+		// Adjust subshape node indices
+		sub_shape_num_nodes_[sub_shape_index]++;
+		for (int32_t i = sub_shape_index + 1; i < static_cast<int32_t>(sub_shape_first_node_.size()); i++)
+			sub_shape_first_node_[i]++;
 
-	// Update animation sequences
-	for (int32_t i_seq = 0; i_seq < sequences_.size(); i_seq++)
-	{
-		// Update animation matters arrays (new node is not animated)
-		TSShape::Sequence& seq = sequences_[i_seq];
-		seq.translation_matters_.Insert(node_index, false);
-		seq.rotation_matters_.Insert(node_index, false);
-		seq.scale_matters_.Insert(node_index, false);
+		// Update animation sequences
+		for (int32_t i_seq = 0; i_seq < static_cast<int32_t>(sequences_.size()); i_seq++)
+		{
+			// Update animation matters arrays (new node is not animated)
+			TSShape::Sequence& seq = sequences_[i_seq];
+			seq.translation_matters_.Insert(node_index, false);
+			seq.rotation_matters_.Insert(node_index, false);
+			seq.scale_matters_.Insert(node_index, false);
+		}
 	}
 
 	// Insert the new node
@@ -154,6 +446,8 @@ bool TSShape::AddNode(const std::string& name, const std::string& parent_name, c
 	node.first_object = -1;
 	node.next_sibling = -1;
 	Vector::Insert(nodes_, node_index, node);
+	InsertIntoLookup(node_lookup_, nodes_, node_index);
+	lookup_nodes_ = nodes_.size();
 
 	// Insert node default translation and rotation
 	Quat16 rot16;
@@ -161,6 +455,17 @@ bool TSShape::AddNode(const std::string& name, const std::string& parent_name, c
 	Vector::Insert(default_translations_, node_index, pos);
 	Vector::Insert(default_rotations_, node_index, rot16);
 
+	// Nobody else's world transform changes; the new node's is worked out when asked for
+	if (world_valid_.size() == nodes_.size() - 1)
+	{
+		Vector::Insert(world_transforms_, node_index);
+		world_valid_.insert(world_valid_.begin() + node_index, false);
+	}
+
+	// Nothing has moved, or CommitEdit does the fixups
+	if (IsEditing())
+		return true;
+
 	// Fixup node indices
 	for (int32_t i = 0; i < nodes_.size(); i++)
 	{
@@ -174,13 +479,21 @@ bool TSShape::AddNode(const std::string& name, const std::string& parent_name, c
 	}
 	for (int32_t i = 0; i < meshes_.size(); i++)
 	{
-		if (meshes_[i] && (meshes_[i]->GetMeshType() == TSMesh::kSkinMeshType))
+		// only skins refer to nodes, so other pending meshes stay pending
+		if (!meshes_[i] && i < static_cast<int32_t>(lazy_meshes_.size()) && lazy_meshes_[i].mesh_type != TSMesh::kSkinMeshType)
+			continue;
+
+		TSMesh* mesh = GetMesh(i);
+		if (mesh && (mesh->GetMeshType() == TSMesh::kSkinMeshType))
 		{
-			TSSkinMesh* skin = dynamic_cast<TSSkinMesh*>(meshes_[i]);
+			TSSkinMesh* skin = dynamic_cast<TSSkinMesh*>(mesh);
 			for (int32_t j = 0; j < skin->node_index_.size(); j++)
 			{
 				if (skin->node_index_[j] >= node_index)
+				{
 					skin->node_index_[j]++;
+					skin->SetDirty();
+				}
 			}
 		}
 	}
@@ -190,6 +503,27 @@ bool TSShape::AddNode(const std::string& name, const std::string& parent_name, c
 
 int32_t TSShape::AddObject(const std::string& objName, int32_t sub_shape_index)
 {
+	if (IsEditing())
+	{
+		// Appended; CommitEdit moves it to the end of the subshape, and adds
+		// its object state
+		TSShape::Object obj;
+		obj.name_index = AddName(objName);
+		obj.node_index = 0;
+		obj.num_meshes = 0;
+		obj.start_mesh_index = 0;
+		obj.first_decal = 0;
+		obj.next_sibling = 0;
+		objects_.push_back(obj);
+		edit_object_sub_shapes_.push_back(sub_shape_index);
+		edit_meshes_.push_back(std::vector<TSMesh*>());
+
+		int32_t obj_index = static_cast<int32_t>(objects_.size()) - 1;
+		InsertIntoLookup(object_lookup_, objects_, obj_index);
+		lookup_objects_ = objects_.size();
+		return obj_index;
+	}
+
 	int32_t obj_index = sub_shape_num_objects_[sub_shape_index];
 
 	// Add object to subshape
@@ -205,6 +539,8 @@ int32_t TSShape::AddObject(const std::string& objName, int32_t sub_shape_index)
 	obj.first_decal = 0;
 	obj.next_sibling = 0;
 	Vector::Insert(objects_, obj_index, obj);
+	InsertIntoLookup(object_lookup_, objects_, obj_index);
+	lookup_objects_ = objects_.size();
 
 	// Add default object state
 	TSShape::ObjectState state;
@@ -224,6 +560,22 @@ void TSShape::AddMeshToObject(int32_t obj_index, int32_t mesh_index, TSMesh* mes
 {
 	TSShape::Object& obj = objects_[obj_index];
 
+	if (IsEditing())
+	{
+		// CommitEdit lays out meshes_ again
+		std::vector<TSMesh*>& obj_meshes = edit_meshes_[obj_index];
+		if (mesh && obj.num_meshes < mesh_index)
+			obj_meshes.resize(mesh_index, nullptr);
+		Vector::Insert(obj_meshes, mesh_index, mesh);
+		obj.num_meshes = static_cast<int32_t>(obj_meshes.size());
+
+		if (mesh && (mesh->GetMeshType() == TSMesh::kSkinMeshType))
+			obj.node_index = -1;
+		return;
+	}
+
+	MaterializeMeshes(); // mesh indices are about to shift
+
 	// Pad with nullptrs if required
 	int32_t old_num_meshes = obj.num_meshes;
 	if (mesh)
@@ -326,6 +678,8 @@ TSMesh* TSShape::CopyMesh(const TSMesh* src_mesh) const
 
 bool TSShape::AddMesh(TSMesh* mesh, const std::string& mesh_name)
 {
+	MaterializeMeshes();
+
 	// Determine the object name and detail size from the mesh name
 	int32_t detail_size = 999;
 	std::string obj_name(String::GetTrailingNumber(mesh_name.c_str(), detail_size));
@@ -388,9 +742,11 @@ bool TSShape::AddMesh(TSMesh* mesh, const std::string& mesh_name)
 	// 2        |           |           |  2
 
 	// Add meshes as required for each object
-	for (int32_t i = 0; i < sub_shape_num_objects_[sub_shape_index]; i++)
+	std::vector<int32_t> sub_shape_objects;
+	GetSubShapeObjects(sub_shape_index, sub_shape_objects);
+	for (int32_t i = 0; i < static_cast<int32_t>(sub_shape_objects.size()); i++)
 	{
-		int32_t index = sub_shape_first_object_[sub_shape_index] + i;
+		int32_t index = sub_shape_objects[i];
 		const TSShape::Object& obj = objects_[index];
 
 		if (index == obj_index)
@@ -399,9 +755,10 @@ bool TSShape::AddMesh(TSMesh* mesh, const std::string& mesh_name)
 			// if required.
 			if (!new_detail && (det_index < obj.num_meshes))
 			{
-				if (meshes_[obj.start_mesh_index + det_index])
-					meshes_[obj.start_mesh_index + det_index]->~TSMesh();
-				meshes_[obj.start_mesh_index + det_index] = mesh;
+				TSMesh*& existing = IsEditing() ? edit_meshes_[index][det_index] : meshes_[obj.start_mesh_index + det_index];
+				if (existing)
+					existing->~TSMesh();
+				existing = mesh;
 			}
 			else
 				AddMeshToObject(index, det_index, mesh);
@@ -417,4 +774,441 @@ bool TSShape::AddMesh(TSMesh* mesh, const std::string& mesh_name)
 	return true;
 }
 
+bool TSShape::RemoveNode(const std::string& name)
+{
+	int32_t node_index = FindNode(name);
+	if (IsEditing() || node_index < 0)
+		return false;
+
+	MaterializeMeshes();
+	RemoveSet set(*this);
+	set.nodes[node_index] = true;
+	ApplyRemoval(set);
+	return true;
+}
+
+bool TSShape::RemoveObject(const std::string& name)
+{
+	int32_t obj_index = FindObject(name);
+	if (IsEditing() || obj_index < 0)
+		return false;
+
+	MaterializeMeshes();
+	RemoveSet set(*this);
+	set.objects[obj_index] = true;
+	ApplyRemoval(set);
+	return true;
+}
+
+bool TSShape::RemoveMesh(const std::string& mesh_name)
+{
+	if (IsEditing())
+		return false;
+
+	MaterializeMeshes();
+
+	// Determine the object name and detail size from the mesh name
+	int32_t detail_size = 999;
+	std::string obj_name(String::GetTrailingNumber(mesh_name.c_str(), detail_size));
+	int32_t obj_index = FindObject(obj_name);
+	if (obj_index < 0)
+		return false;
+
+	// Find the mesh's detail level amongst those of the object's subshape
+	std::vector<int32_t> valid_details;
+	GetSubShapeDetails(GetSubShapeForObject(obj_index), valid_details);
+	int32_t det_index;
+	for (det_index = 0; det_index < static_cast<int32_t>(valid_details.size()); det_index++)
+	{
+		if (details_[valid_details[det_index]].size == detail_size)
+			break;
+	}
+	if (det_index == static_cast<int32_t>(valid_details.size()))
+		return false;
+
+	const TSShape::Object& obj = objects_[obj_index];
+	int32_t slot = details_[valid_details[det_index]].object_detail_num;
+	if ((slot < 0) || (slot >= obj.num_meshes) || !meshes_[obj.start_mesh_index + slot])
+		return false;
+
+	DeleteMesh(meshes_[obj.start_mesh_index + slot]);
+	meshes_[obj.start_mesh_index + slot] = nullptr;
+
+	// Remove trailing nullptr meshes from the object (and the object, if
+	// that's all of them)
+	RemoveSet set(*this);
+	for (slot = obj.num_meshes - 1; slot >= 0 && !meshes_[obj.start_mesh_index + slot]; slot--)
+		set.meshes[obj.start_mesh_index + slot] = true;
+	ApplyRemoval(set);
+	return true;
+}
+
+bool TSShape::RemoveDetail(int32_t size)
+{
+	if (IsEditing())
+		return false;
+
+	int32_t det_index;
+	for (det_index = 0; det_index < static_cast<int32_t>(details_.size()); det_index++)
+	{
+		if (details_[det_index].size == size)
+			break;
+	}
+	if (det_index == static_cast<int32_t>(details_.size()))
+		return false;
+
+	MaterializeMeshes();
+	RemoveSet set(*this);
+	set.details[det_index] = true;
+	ApplyRemoval(set);
+	return true;
+}
+
+bool TSShape::RemoveSequence(const std::string& name)
+{
+	int32_t seq_index = FindSequence(name);
+	if (IsEditing() || seq_index < 0)
+		return false;
+
+	MaterializeMeshes();
+	RemoveSet set(*this);
+	set.sequences[seq_index] = true;
+	ApplyRemoval(set);
+	return true;
+}
+
+void TSShape::Compact()
+{
+	if (IsEditing())
+		return;
+
+	MaterializeMeshes();
+	RemoveSet set(*this);
+	set.unused_names = true;
+
+	std::vector<bool> owned(meshes_.size(), false);
+	std::vector<int32_t> valid_details;
+	for (int32_t i = 0; i < static_cast<int32_t>(objects_.size()); i++)
+	{
+		const TSShape::Object& obj = objects_[i];
+		int32_t end = std::min(obj.num_meshes, static_cast<int32_t>(meshes_.size()) - obj.start_mesh_index);
+
+		// Meshes past the last detail of the subshape are never shown
+		int32_t num_slots = end;
+		GetSubShapeDetails(GetSubShapeForObject(i), valid_details);
+		if (!valid_details.empty())
+		{
+			num_slots = 0;
+			for (int32_t j = 0; j < static_cast<int32_t>(valid_details.size()); j++)
+				num_slots = std::max(num_slots, details_[valid_details[j]].object_detail_num + 1);
+		}
+
+		int32_t slot;
+		for (slot = 0; slot < end; slot++)
+		{
+			owned[obj.start_mesh_index + slot] = true;
+			set.meshes[obj.start_mesh_index + slot] = (slot >= num_slots);
+		}
+		for (slot = std::min(end, num_slots) - 1; slot >= 0 && !meshes_[obj.start_mesh_index + slot]; slot--)
+			set.meshes[obj.start_mesh_index + slot] = true;
+	}
+
+	for (int32_t i = 0; i < static_cast<int32_t>(meshes_.size()); i++)
+	{
+		if (!owned[i])
+			set.meshes[i] = true;
+	}
+
+	ApplyRemoval(set);
+}
+
+void TSShape::ApplyRemoval(RemoveSet& set)
+{
+	int32_t i, j;
+
+	// A detail's meshes are those at its object_detail_num in every object of
+	// its subshape; the details after it in the subshape move up
+	std::vector<int32_t> detail_nums(details_.size());
+	for (i = 0; i < static_cast<int32_t>(details_.size()); i++)
+	{
+		const TSShape::Detail& det = details_[i];
+		detail_nums[i] = det.object_detail_num;
+		if (set.details[i] && (det.sub_shape_num >= 0) && (det.sub_shape_num < static_cast<int32_t>(sub_shape_first_object_.size())))
+		{
+			int32_t first = sub_shape_first_object_[det.sub_shape_num];
+			for (j = first; j < first + sub_shape_num_objects_[det.sub_shape_num] && j < static_cast<int32_t>(objects_.size()); j++)
+			{
+				const TSShape::Object& obj = objects_[j];
+				int32_t slot = obj.start_mesh_index + det.object_detail_num;
+				if ((det.object_detail_num >= 0) && (det.object_detail_num < obj.num_meshes) && (slot < static_cast<int32_t>(meshes_.size())))
+					set.meshes[slot] = true;
+			}
+		}
+	}
+	for (i = 0; i < static_cast<int32_t>(details_.size()); i++)
+	{
+		if (!set.details[i])
+			continue;
+		for (j = 0; j < static_cast<int32_t>(details_.size()); j++)
+		{
+			if (!set.details[j] && (details_[j].sub_shape_num == details_[i].sub_shape_num) &&
+				(details_[j].object_detail_num > details_[i].object_detail_num))
+				detail_nums[j]--;
+		}
+	}
+
+	// An object's meshes go with it, and an object left without meshes goes
+	for (i = 0; i < static_cast<int32_t>(objects_.size()); i++)
+	{
+		const TSShape::Object& obj = objects_[i];
+		int32_t end = std::min(obj.start_mesh_index + obj.num_meshes, static_cast<int32_t>(meshes_.size()));
+		bool any_kept = false;
+		for (j = obj.start_mesh_index; j < end; j++)
+		{
+			if (set.objects[i])
+				set.meshes[j] = true;
+			any_kept |= !set.meshes[j];
+		}
+		if ((obj.num_meshes > 0) && !any_kept)
+			set.objects[i] = true;
+	}
+
+	// Names that only dropped things used go, or with unused_names, every name
+	// nothing kept uses
+	std::vector<bool> name_used(names_.Size(), false);
+	std::vector<bool> name_dropped(names_.Size(), set.unused_names);
+	auto use_name = [&](int32_t name_index, bool dropped)
+	{
+		if (name_index >= 0 && name_index < names_.Size())
+			(dropped ? name_dropped : name_used)[name_index] = true;
+	};
+	for (i = 0; i < static_cast<int32_t>(nodes_.size()); i++)
+		use_name(nodes_[i].name_index, set.nodes[i]);
+	for (i = 0; i < static_cast<int32_t>(objects_.size()); i++)
+		use_name(objects_[i].name_index, set.objects[i]);
+	for (i = 0; i < static_cast<int32_t>(details_.size()); i++)
+		use_name(details_[i].name_index, set.details[i]);
+	for (i = 0; i < static_cast<int32_t>(sequences_.size()); i++)
+		use_name(sequences_[i].name_index_, set.sequences[i]);
+
+	std::vector<bool> drop_names(names_.Size());
+	for (i = 0; i < names_.Size(); i++)
+		drop_names[i] = name_dropped[i] && !name_used[i];
+
+	std::vector<int32_t> nodes_before = KeptBefore(set.nodes);
+	std::vector<int32_t> objects_before = KeptBefore(set.objects);
+	std::vector<int32_t> meshes_before = KeptBefore(set.meshes);
+	std::vector<int32_t> node_map = NewIndices(set.nodes, nodes_before);
+	std::vector<int32_t> object_map = NewIndices(set.objects, objects_before);
+
+	// References to a node that's dropped go to its closest kept ancestor
+	auto node_target = [&](int32_t node_index)
+	{
+		while (node_index >= 0 && node_index < static_cast<int32_t>(nodes_.size()) && node_map[node_index] < 0)
+			node_index = nodes_[node_index].parent_index;
+		return (node_index >= 0 && node_index < static_cast<int32_t>(nodes_.size())) ? node_map[node_index] : -1;
+	};
+
+	// Meshes: drop those marked, and fix up the others' skin bones and the
+	// parents they share vertex data with (which must be there and in front)
+	for (i = 0; i < static_cast<int32_t>(meshes_.size()); i++)
+	{
+		TSMesh* mesh = meshes_[i];
+		if (set.meshes[i])
+		{
+			DeleteMesh(mesh);
+			continue;
+		}
+		if (!mesh)
+			continue;
+
+		int32_t parent = mesh->parent_mesh_;
+		if (parent >= 0)
+		{
+			int32_t new_parent = (parent < i && !set.meshes[parent] && meshes_[parent]) ? meshes_before[parent] : -1;
+			if (new_parent != parent)
+			{
+				mesh->parent_mesh_ = new_parent;
+				mesh->SetDirty();
+			}
+		}
+
+		if (mesh->GetMeshType() == TSMesh::kSkinMeshType)
+		{
+			TSSkinMesh* skin = dynamic_cast<TSSkinMesh*>(mesh);
+			for (j = 0; j < static_cast<int32_t>(skin->node_index_.size()); j++)
+			{
+				int32_t node_index = node_target(skin->node_index_[j]);
+				if (node_index != skin->node_index_[j])
+				{
+					skin->node_index_[j] = node_index;
+					skin->SetDirty();
+				}
+			}
+		}
+	}
+	EraseMarked(meshes_, set.meshes);
+
+	// Animation keys: keep only those of kept sequences for kept nodes and
+	// objects, along with the default state of every kept object
+	std::vector<bool> drop_rotations(node_rotations_.size(), true);
+	std::vector<bool> drop_translations(node_translations_.size(), true);
+	std::vector<bool> drop_uniform_scales(node_uniform_scales_.size(), true);
+	std::vector<bool> drop_aligned_scales(node_aligned_scales_.size(), true);
+	std::vector<bool> drop_arbitrary_scales(node_arbitrary_scale_factors_.size(), true);
+	std::vector<bool> drop_object_states(object_states_.size(), true);
+	std::vector<bool> drop_ground_frames(ground_translations_.size(), true);
+	std::vector<bool> drop_triggers(triggers_.size(), true);
+
+	for (i = 0; i < static_cast<int32_t>(objects_.size()) && i < static_cast<int32_t>(object_states_.size()); i++)
+		drop_object_states[i] = set.objects[i];
+
+	for (i = 0; i < static_cast<int32_t>(sequences_.size()); i++)
+	{
+		if (set.sequences[i])
+			continue;
+
+		const TSShape::Sequence& seq = sequences_[i];
+		KeepRows(drop_rotations, seq.rotation_matters_, seq.base_rotation_, seq.num_keyframes_, node_map);
+		KeepRows(drop_translations, seq.translation_matters_, seq.base_translation_, seq.num_keyframes_, node_map);
+		if (seq.flags_ & kArbitraryScale)
+			KeepRows(drop_arbitrary_scales, seq.scale_matters_, seq.base_scale_, seq.num_keyframes_, node_map);
+		else if (seq.flags_ & kAlignedScale)
+			KeepRows(drop_aligned_scales, seq.scale_matters_, seq.base_scale_, seq.num_keyframes_, node_map);
+		else
+			KeepRows(drop_uniform_scales, seq.scale_matters_, seq.base_scale_, seq.num_keyframes_, node_map);
+
+		// an object has states if any of them change
+		TSIntegerSet object_matters = seq.frame_matters_;
+		object_matters.Overlap(seq.mat_frame_matters_);
+		object_matters.Overlap(seq.vis_matters_);
+		KeepRows(drop_object_states, object_matters, seq.base_object_state_, seq.num_keyframes_, object_map);
+
+		KeepRange(drop_ground_frames, seq.first_ground_frame_, seq.num_ground_frames_);
+		KeepRange(drop_triggers, seq.first_trigger_, seq.num_triggers_);
+	}
+
+	std::vector<int32_t> rotations_before = KeptBefore(drop_rotations);
+	std::vector<int32_t> translations_before = KeptBefore(drop_translations);
+	std::vector<int32_t> uniform_scales_before = KeptBefore(drop_uniform_scales);
+	std::vector<int32_t> aligned_scales_before = KeptBefore(drop_aligned_scales);
+	std::vector<int32_t> arbitrary_scales_before = KeptBefore(drop_arbitrary_scales);
+	std::vector<int32_t> object_states_before = KeptBefore(drop_object_states);
+	std::vector<int32_t> ground_frames_before = KeptBefore(drop_ground_frames);
+	std::vector<int32_t> triggers_before = KeptBefore(drop_triggers);
+
+	for (i = 0; i < static_cast<int32_t>(sequences_.size()); i++)
+	{
+		if (set.sequences[i])
+			continue;
+
+		TSShape::Sequence& seq = sequences_[i];
+		RebaseKeys(seq.base_rotation_, rotations_before);
+		RebaseKeys(seq.base_translation_, translations_before);
+		if (seq.flags_ & kArbitraryScale)
+			RebaseKeys(seq.base_scale_, arbitrary_scales_before);
+		else if (seq.flags_ & kAlignedScale)
+			RebaseKeys(seq.base_scale_, aligned_scales_before);
+		else
+			RebaseKeys(seq.base_scale_, uniform_scales_before);
+		RebaseKeys(seq.base_object_state_, object_states_before);
+		RebaseKeys(seq.first_ground_frame_, ground_frames_before);
+		RebaseKeys(seq.first_trigger_, triggers_before);
+
+		seq.rotation_matters_.Remap(Vector::Address(node_map), static_cast<int32_t>(node_map.size()));
+		seq.translation_matters_.Remap(Vector::Address(node_map), static_cast<int32_t>(node_map.size()));
+		seq.scale_matters_.Remap(Vector::Address(node_map), static_cast<int32_t>(node_map.size()));
+		seq.vis_matters_.Remap(Vector::Address(object_map), static_cast<int32_t>(object_map.size()));
+		seq.frame_matters_.Remap(Vector::Address(object_map), static_cast<int32_t>(object_map.size()));
+		seq.mat_frame_matters_.Remap(Vector::Address(object_map), static_cast<int32_t>(object_map.size()));
+	}
+
+	EraseMarked(node_rotations_, drop_rotations);
+	EraseMarked(node_translations_, drop_translations);
+	EraseMarked(node_uniform_scales_, drop_uniform_scales);
+	EraseMarked(node_aligned_scales_, drop_aligned_scales);
+	EraseMarked(node_arbitrary_scale_factors_, drop_arbitrary_scales);
+	EraseMarked(node_arbitrary_scale_rots_, drop_arbitrary_scales);
+	EraseMarked(object_states_, drop_object_states);
+	EraseMarked(ground_translations_, drop_ground_frames);
+	EraseMarked(ground_rotations_, drop_ground_frames);
+	EraseMarked(triggers_, drop_triggers);
+	EraseMarked(sequences_, set.sequences);
+
+	// Nodes and objects
+	for (i = 0; i < static_cast<int32_t>(nodes_.size()); i++)
+	{
+		// the dropped ones are still needed to find ancestors
+		if (!set.nodes[i])
+			nodes_[i].parent_index = node_target(nodes_[i].parent_index);
+	}
+	for (i = 0; i < static_cast<int32_t>(objects_.size()); i++)
+	{
+		TSShape::Object& obj = objects_[i];
+		if (obj.node_index >= 0)
+			obj.node_index = node_target(obj.node_index);
+
+		int32_t start = std::min(obj.start_mesh_index, static_cast<int32_t>(meshes_before.size()) - 1);
+		int32_t end = std::min(obj.start_mesh_index + obj.num_meshes, static_cast<int32_t>(meshes_before.size()) - 1);
+		obj.start_mesh_index = meshes_before[start];
+		obj.num_meshes = meshes_before[end] - meshes_before[start];
+	}
+	EraseMarked(nodes_, set.nodes);
+	EraseMarked(default_translations_, set.nodes);
+	EraseMarked(default_rotations_, set.nodes);
+	EraseMarked(objects_, set.objects);
+
+	for (i = 0; i < static_cast<int32_t>(sub_shape_first_node_.size()); i++)
+	{
+		int32_t first = std::min(sub_shape_first_node_[i], static_cast<int32_t>(set.nodes.size()));
+		int32_t end = std::min(first + sub_shape_num_nodes_[i], static_cast<int32_t>(set.nodes.size()));
+		sub_shape_first_node_[i] = nodes_before[first];
+		sub_shape_num_nodes_[i] = nodes_before[end] - nodes_before[first];
+	}
+	for (i = 0; i < static_cast<int32_t>(sub_shape_first_object_.size()); i++)
+	{
+		int32_t first = std::min(sub_shape_first_object_[i], static_cast<int32_t>(set.objects.size()));
+		int32_t end = std::min(first + sub_shape_num_objects_[i], static_cast<int32_t>(set.objects.size()));
+		sub_shape_first_object_[i] = objects_before[first];
+		sub_shape_num_objects_[i] = objects_before[end] - objects_before[first];
+	}
+
+	// Details
+	for (i = 0; i < static_cast<int32_t>(details_.size()); i++)
+		details_[i].object_detail_num = detail_nums[i];
+	EraseMarked(details_, set.details);
+	UpdateSmallestVisibleDL();
+
+	// Names
+	if (std::find(drop_names.begin(), drop_names.end(), true) != drop_names.end())
+	{
+		TSNamePool names;
+		std::vector<int32_t> name_map(names_.Size(), -1);
+		for (i = 0; i < names_.Size(); i++)
+		{
+			if (!drop_names[i])
+				name_map[i] = names.Add(names_.GetString(i));
+		}
+
+		auto remap_name = [&](int32_t& name_index)
+		{
+			if (name_index >= 0 && name_index < static_cast<int32_t>(name_map.size()))
+				name_index = name_map[name_index];
+		};
+		for (i = 0; i < static_cast<int32_t>(nodes_.size()); i++)
+			remap_name(nodes_[i].name_index);
+		for (i = 0; i < static_cast<int32_t>(objects_.size()); i++)
+			remap_name(objects_[i].name_index);
+		for (i = 0; i < static_cast<int32_t>(details_.size()); i++)
+			remap_name(details_[i].name_index);
+		for (i = 0; i < static_cast<int32_t>(sequences_.size()); i++)
+			remap_name(sequences_[i].name_index_);
+
+		std::swap(names_, names);
+	}
+
+	RebuildLookup();
+	InvalidateWorldTransforms(); // children of dropped nodes moved
+}
+
 } // namespace DTS
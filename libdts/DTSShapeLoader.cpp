@@ -0,0 +1,192 @@
+#include "DTSShapeLoader.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include "DTSMaterialList.h"
+
+namespace DTS
+{
+
+namespace
+{
+
+// A file that has been read ahead, waiting to be assembled.
+struct PendingFile
+{
+	std::size_t index;
+	ShapeLoadResult::Status status; // kOk once read
+	std::vector<char> bytes;
+};
+
+ShapeLoadResult::Status ReadWholeFile(const std::string& path, std::vector<char>& bytes)
+{
+	std::ifstream ifs(path, std::ios::in | std::ios::binary);
+	if (!ifs.is_open())
+		return ShapeLoadResult::kOpenFailed;
+
+	ifs.seekg(0, std::ios::end);
+	std::streamoff size = ifs.tellg();
+	ifs.seekg(0, std::ios::beg);
+	if (size < 0)
+		return ShapeLoadResult::kReadFailed;
+
+	try
+	{
+		bytes.resize(static_cast<std::size_t>(size));
+	}
+	catch (...)
+	{
+		return ShapeLoadResult::kReadFailed;
+	}
+	if (size > 0)
+		ifs.read(Vector::Address(bytes), size);
+	return ifs.good() ? ShapeLoadResult::kOk : ShapeLoadResult::kReadFailed;
+}
+
+} // namespace
+
+std::vector<ShapeLoadResult> LoadShapes(const std::vector<std::string>& paths, int32_t threads,
+	const TSShape::LoadOptions& options)
+{
+	std::vector<ShapeLoadResult> results(paths.size());
+	for (std::size_t i = 0; i < results.size(); i++)
+	{
+		results[i].status = ShapeLoadResult::kReadFailed;
+		results[i].shape = nullptr;
+	}
+
+	if (threads <= 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	if (static_cast<std::size_t>(threads) > paths.size())
+		threads = static_cast<int32_t>(std::max<std::size_t>(1, paths.size()));
+
+	// Files read ahead are queued here; the queue is bounded so memory use
+	// stays proportional to the number of workers, not the number of files.
+	const std::size_t max_pending = 2 * threads;
+	std::deque<PendingFile> pending;
+	bool reading_done = false;
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+
+	std::thread reader([&]()
+	{
+		for (std::size_t i = 0; i < paths.size(); i++)
+		{
+			PendingFile file;
+			file.index = i;
+			file.status = ReadWholeFile(paths[i], file.bytes);
+
+			std::unique_lock<std::mutex> lock(mutex);
+			not_full.wait(lock, [&]() { return pending.size() < max_pending; });
+			pending.push_back(std::move(file));
+			not_empty.notify_one();
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		reading_done = true;
+		not_empty.notify_all();
+	});
+
+	std::vector<std::thread> workers;
+	for (int32_t t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&]()
+		{
+			for (;;)
+			{
+				PendingFile file;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					not_empty.wait(lock, [&]() { return !pending.empty() || reading_done; });
+					if (pending.empty())
+						return;
+					file = std::move(pending.front());
+					pending.pop_front();
+					not_full.notify_one();
+				}
+
+				// each result slot is only ever touched by one worker
+				ShapeLoadResult& result = results[file.index];
+				if (file.status != ShapeLoadResult::kOk)
+				{
+					result.status = file.status;
+					continue;
+				}
+
+				// a corrupt file can ask for more than can be allocated; that
+				// must fail the one file, not take the process down with it
+				TSShape* shape = nullptr;
+				bool loaded = false;
+				try
+				{
+					shape = new TSShape;
+					loaded = shape->LoadFromMemory(Vector::Address(file.bytes), file.bytes.size(), options);
+				}
+				catch (...)
+				{
+					loaded = false;
+				}
+
+				if (loaded)
+				{
+					result.status = ShapeLoadResult::kOk;
+					result.shape = shape;
+				}
+				else
+				{
+					delete shape;
+				}
+			}
+		});
+	}
+
+	reader.join();
+	for (std::size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	return results;
+}
+
+bool ProbeShape(const std::string& filename, ShapeInfo* info)
+{
+	std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+	if (!ifs.is_open())
+		return false;
+
+	TSShape::LoadOptions options;
+	options.skip_meshes = true;
+
+	TSShape shape;
+	if (!shape.LoadFromStream(ifs, options))
+		return false;
+
+	info->version = shape.read_version_;
+	info->exporter_version = static_cast<int32_t>(shape.exporter_version_);
+
+	info->num_nodes = static_cast<int32_t>(shape.nodes_.size());
+	info->num_objects = static_cast<int32_t>(shape.objects_.size());
+	info->num_meshes = static_cast<int32_t>(shape.meshes_.size());
+	info->num_details = static_cast<int32_t>(shape.details_.size());
+	info->num_sub_shapes = static_cast<int32_t>(shape.sub_shape_first_node_.size());
+
+	info->radius = shape.radius_;
+	info->tube_radius = shape.tube_radius_;
+	info->center = shape.center_;
+	info->bounds = shape.bounds_;
+
+	std::swap(info->names, shape.names_);
+	info->sequences.swap(shape.sequences_);
+	info->material_names.resize(shape.material_list_->Size());
+	for (uint32_t i = 0; i < shape.material_list_->Size(); i++)
+		info->material_names[i] = shape.material_list_->GetMaterialName(i);
+
+	return true;
+}
+
+} // namespace DTS
@@ -0,0 +1,62 @@
+#ifndef DTS_SHAPELOADER_H_
+#define DTS_SHAPELOADER_H_
+
+#include <string>
+#include <vector>
+
+#include "DTSShape.h"
+
+namespace DTS
+{
+
+// Outcome of loading a single file with LoadShapes.
+struct ShapeLoadResult
+{
+	enum Status
+	{
+		kOk,
+		kOpenFailed,	// file could not be opened
+		kReadFailed		// file could not be read, or is not a valid/supported shape
+	};
+
+	Status status;
+	TSShape* shape; // owned by the caller, nullptr unless status is kOk
+};
+
+// Reads, decodes and assembles a list of shapes on a pool of worker threads.
+// File reads are done ahead of the workers on a separate thread so that I/O
+// overlaps with assembly.  Results are returned in the same order as paths.
+// A thread count of 0 uses one worker per hardware thread.  Every shape is
+// loaded with the same options.
+std::vector<ShapeLoadResult> LoadShapes(const std::vector<std::string>& paths, int32_t threads = 0,
+	const TSShape::LoadOptions& options = TSShape::LoadOptions());
+
+// Summary of a shape file, as read by ProbeShape.
+struct ShapeInfo
+{
+	int32_t version;
+	int32_t exporter_version;
+
+	int32_t num_nodes;
+	int32_t num_objects;
+	int32_t num_meshes; // includes pre v23 skins
+	int32_t num_details;
+	int32_t num_sub_shapes;
+
+	float radius;
+	float tube_radius;
+	Point3F center;
+	Box3F bounds;
+
+	TSNamePool names;
+	std::vector<TSShape::Sequence> sequences;
+	std::vector<std::string> material_names;
+};
+
+// Reads a shape's counts, bounds, names, sequences and materials without
+// assembling any of its meshes, which are only walked past.
+bool ProbeShape(const std::string& filename, ShapeInfo* info);
+
+} // namespace DTS
+
+#endif // DTS_SHAPELOADER_H_
@@ -5,12 +5,12 @@
 namespace DTS
 {
 
-bool TSShape::Sequence::LoadFromStream(IStream& is, bool read_name_index)
+bool TSShape::Sequence::LoadFromStream(IStream& is, int32_t read_version, bool read_name_index)
 {
 	if (read_name_index)
 		is.Read(&name_index_);
 	flags_ = 0;
-	if (TSShape::current_read_version_ > 21)
+	if (read_version > 21)
 		is.Read(&flags_);
 	else
 		flags_ = 0;
@@ -18,7 +18,7 @@ bool TSShape::Sequence::LoadFromStream(IStream& is, bool read_name_index)
 	is.Read(&num_keyframes_);
 	is.Read(&duration_);
 
-	if (TSShape::current_read_version_ < 22)
+	if (read_version < 22)
 	{
 		bool tmp = false;
 		is.Read(&tmp);
@@ -35,7 +35,7 @@ bool TSShape::Sequence::LoadFromStream(IStream& is, bool read_name_index)
 	is.Read(&priority_);
 	is.Read(&first_ground_frame_);
 	is.Read(&num_ground_frames_);
-	if (TSShape::current_read_version_ > 21)
+	if (read_version > 21)
 	{
 		is.Read(&base_rotation_);
 		is.Read(&base_translation_);
@@ -57,7 +57,7 @@ bool TSShape::Sequence::LoadFromStream(IStream& is, bool read_name_index)
 
 	// now the membership sets:
 	rotation_matters_.LoadFromStream(is);
-	if (TSShape::current_read_version_ < 22)
+	if (read_version < 22)
 		translation_matters_ = rotation_matters_;
 	else
 	{
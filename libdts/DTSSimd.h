@@ -0,0 +1,22 @@
+#ifndef DTS_SIMD_H_
+#define DTS_SIMD_H_
+
+// Which vector instructions the batch kernels use.  SSE2 is on every x86-64
+// CPU; AVX2 only when the library is built for it (LIBDTS_AVX2).  Defining
+// DTS_NO_SIMD leaves just the plain C++ versions.
+#if !defined(DTS_NO_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DTS_SSE2 1
+#endif
+#if defined(__AVX2__)
+#define DTS_AVX2 1
+#endif
+#endif
+
+#if defined(DTS_AVX2)
+#include <immintrin.h>
+#elif defined(DTS_SSE2)
+#include <emmintrin.h>
+#endif
+
+#endif // DTS_SIMD_H_
@@ -5,59 +5,86 @@
 namespace DTS
 {
 
-#define tsalloc TSShape::alloc_
+void TSSortedMesh::Skip(ITSShapeAlloc& alloc, int32_t mesh_index)
+{
+	TSMesh::Skip(alloc, mesh_index);
+
+	int32_t num_clusters = alloc.IMemBuffer32::Get();
+	alloc.IMemBuffer32::GetPointer(num_clusters * 8);
+
+	// start cluster, first verts, num verts, first tverts
+	for (int32_t i = 0; i < 4; i++)
+	{
+		int32_t sz = alloc.IMemBuffer32::Get();
+		alloc.IMemBuffer32::GetPointer(sz);
+	}
+
+	alloc.IMemBuffer32::Get(); // always_write_depth
+
+	alloc.CheckGuard();
+}
 
-void TSSortedMesh::Assemble(bool skip)
+void TSSortedMesh::Assemble(ITSShapeAlloc& alloc)
 {
-	TSMesh::Assemble(skip);
+	TSMesh::Assemble(alloc);
 
-	int32_t num_clusters = tsalloc.IMemBuffer32::Get();
-	int32_t* ptr32 = tsalloc.IMemBuffer32::CopyToShape(num_clusters * 8);
+	int32_t num_clusters = alloc.IMemBuffer32::Get();
+	int32_t* ptr32 = alloc.IMemBuffer32::GetPointer(num_clusters * 8);
 	Vector::Set(clusters_, ptr32, num_clusters);
 
-	int32_t sz = tsalloc.IMemBuffer32::Get();
-	ptr32 = tsalloc.IMemBuffer32::CopyToShape(sz);
+	int32_t sz = alloc.IMemBuffer32::Get();
+	ptr32 = alloc.IMemBuffer32::GetPointer(sz);
 	Vector::Set(clusters_, ptr32, sz);
 
-	sz = tsalloc.IMemBuffer32::Get();
-	ptr32 = tsalloc.IMemBuffer32::CopyToShape(sz);
+	sz = alloc.IMemBuffer32::Get();
+	ptr32 = alloc.IMemBuffer32::GetPointer(sz);
 	Vector::Set(first_verts_, ptr32, sz);
 
-	sz = tsalloc.IMemBuffer32::Get();
-	ptr32 = tsalloc.IMemBuffer32::CopyToShape(sz);
+	sz = alloc.IMemBuffer32::Get();
+	ptr32 = alloc.IMemBuffer32::GetPointer(sz);
 	Vector::Set(num_verts_, ptr32, sz);
 
-	sz = tsalloc.IMemBuffer32::Get();
-	ptr32 = tsalloc.IMemBuffer32::CopyToShape(sz);
+	sz = alloc.IMemBuffer32::Get();
+	ptr32 = alloc.IMemBuffer32::GetPointer(sz);
 	Vector::Set(first_tverts_, ptr32, sz);
 
-	always_write_depth_ = tsalloc.IMemBuffer32::Get() != 0;
+	always_write_depth_ = alloc.IMemBuffer32::Get() != 0;
 
-	tsalloc.CheckGuard();
+	alloc.CheckGuard();
 }
 
-void TSSortedMesh::Disassemble()
+void TSSortedMesh::Disassemble(OTSShapeAlloc& alloc)
 {
-	TSMesh::Disassemble();
+	TSMesh::Disassemble(alloc);
+
+	alloc.OMemBuffer32::Set(clusters_.size());
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(clusters_)), clusters_.size() * 8);
 
-	tsalloc.OMemBuffer32::Set(clusters_.size());
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(clusters_)), clusters_.size() * 8);
+	alloc.OMemBuffer32::Set(start_cluster_.size());
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(start_cluster_)), start_cluster_.size());
 
-	tsalloc.OMemBuffer32::Set(start_cluster_.size());
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(start_cluster_)), start_cluster_.size());
+	alloc.OMemBuffer32::Set(first_verts_.size());
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(first_verts_)), first_verts_.size());
 
-	tsalloc.OMemBuffer32::Set(first_verts_.size());
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(first_verts_)), first_verts_.size());
+	alloc.OMemBuffer32::Set(num_verts_.size());
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(num_verts_)), num_verts_.size());
 
-	tsalloc.OMemBuffer32::Set(num_verts_.size());
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(num_verts_)), num_verts_.size());
+	alloc.OMemBuffer32::Set(first_tverts_.size());
+	alloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(first_tverts_)), first_tverts_.size());
 
-	tsalloc.OMemBuffer32::Set(first_tverts_.size());
-	tsalloc.OMemBuffer32::CopyToBuffer(reinterpret_cast<int32_t*>(Vector::Address(first_tverts_)), first_tverts_.size());
+	alloc.OMemBuffer32::Set(always_write_depth_ ? 1 : 0);
 
-	tsalloc.OMemBuffer32::Set(always_write_depth_ ? 1 : 0);
+	alloc.SetGuard();
+}
+
+void TSSortedMesh::AddWriteSize(int32_t* size32, int32_t* size16, int32_t* size8) const
+{
+	TSMesh::AddWriteSize(size32, size16, size8);
 
-	tsalloc.SetGuard();
+	// five counts, the depth flag and a guard
+	*size32 += 7 + 8 * clusters_.size() + start_cluster_.size() + first_verts_.size() + num_verts_.size() + first_tverts_.size();
+	*size16 += 1;
+	*size8 += 1;
 }
 
 } // namespace DTS
@@ -31,8 +31,10 @@ public:
 	}
 
 	// persist methods...
-	void Assemble(bool skip);
-	void Disassemble();
+	void Assemble(ITSShapeAlloc& alloc);
+	void Disassemble(OTSShapeAlloc& alloc);
+	void AddWriteSize(int32_t* size32, int32_t* size16, int32_t* size8) const;
+	static void Skip(ITSShapeAlloc& alloc, int32_t mesh_index);
 
 	std::vector<Cluster> clusters_;			// All of the clusters of primitives to be drawn
 	std::vector<int32_t> start_cluster_;	// indexed by frame number
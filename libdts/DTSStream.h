@@ -2,25 +2,43 @@
 #define DTS_STREAM_H_
 
 #include <iostream>
+#include <streambuf>
 #include <cstdint>
 #include <cassert>
 #include <cstring>
+#include <vector>
 
 #include "DTSEndian.h"
 
 namespace DTS
 {
 
-// Base stream class for streaming data across a specific media
+// Decodes from a block of memory.  The block is either one given to us, or
+// a buffer refilled from a std::istream, so that the many small reads made
+// while parsing are plain copies rather than calls into the stream.
 class IStream
 {
 public:
-	IStream(std::istream& is) :
-		is_(is) {}
+	static const int32_t kBufferSize = 4096;
+
+	// Reads straight from data, which has to outlive us
+	explicit IStream(const void* data, std::size_t size) :
+		is_(nullptr), cur_(static_cast<const char*>(data)), end_(cur_ + size), good_(true) {}
+
+	// Reads through a buffer.  Whatever was buffered but not read is handed
+	// back to the stream on destruction, where the stream can seek.
+	explicit IStream(std::istream& is) :
+		is_(&is), cur_(nullptr), end_(nullptr), good_(is.good()) {}
+
+	~IStream()
+	{
+		if (is_ && cur_ != end_)
+			is_->rdbuf()->pubseekoff(cur_ - end_, std::ios::cur, std::ios::in);
+	}
 
 	bool Good()
 	{
-		return is_.good();
+		return good_;
 	}
 
 	template <typename T>
@@ -45,18 +63,15 @@ public:
 
 	bool Read(void* buffer, int32_t num_bytes)
 	{
-		// exit on pre-existing errors
-		if (!is_.good())
-			return false;
-
-		// if a request of non-zero length was made
-		if (0 != num_bytes)
+		if (good_ && num_bytes <= end_ - cur_)
 		{
-			is_.read(reinterpret_cast<char *>(buffer), num_bytes);
-			return is_.good();
+			if (0 != num_bytes)
+				memcpy(buffer, cur_, num_bytes);
+			cur_ += num_bytes;
+			return true;
 		}
 
-		return true;
+		return ReadSlow(reinterpret_cast<char *>(buffer), num_bytes);
 	}
 
 	void ReadString(char buf[256])
@@ -68,18 +83,90 @@ public:
 	}
 
 private:
-	std::istream& is_;
+	// more than is buffered, or an error
+	bool ReadSlow(char* buffer, int32_t num_bytes)
+	{
+		// exit on pre-existing errors
+		if (!good_)
+			return false;
+
+		int32_t buffered = static_cast<int32_t>(end_ - cur_);
+		if (buffered)
+			memcpy(buffer, cur_, buffered);
+		buffer += buffered;
+		num_bytes -= buffered;
+		cur_ = end_;
+
+		if (!is_)
+			return Fail();
+
+		// large reads skip the buffer
+		std::streambuf* sb = is_->rdbuf();
+		if (num_bytes >= kBufferSize)
+			return sb->sgetn(buffer, num_bytes) == num_bytes || Fail();
+
+		std::streamsize got = sb->sgetn(buffer_, kBufferSize);
+		cur_ = buffer_;
+		end_ = buffer_ + got;
+		if (got < num_bytes)
+			return Fail();
+
+		memcpy(buffer, cur_, num_bytes);
+		cur_ += num_bytes;
+		return true;
+	}
+
+	// like a short std::istream::read
+	bool Fail()
+	{
+		good_ = false;
+		cur_ = end_;
+		if (is_)
+			is_->setstate(std::ios::eofbit | std::ios::failbit);
+		return false;
+	}
+
+	std::istream* is_;
+	const char* cur_;
+	const char* end_;
+	bool good_;
+	char buffer_[kBufferSize];
 };
 
+// Encodes into a buffer that is written out to a std::ostream in bulk when
+// it fills up and on Flush, or appended to a block of memory.
 class OStream
 {
 public:
-	OStream(std::ostream& os) :
-		os_(os) {}
+	static const int32_t kBufferSize = 4096;
+
+	explicit OStream(std::ostream& os) :
+		os_(&os), block_(nullptr), used_(0) {}
+
+	// Appends to block
+	explicit OStream(std::vector<char>* block) :
+		os_(nullptr), block_(block), used_(0) {}
+
+	~OStream()
+	{
+		Flush();
+	}
 
 	bool Good()
 	{
-		return os_.good();
+		return !os_ || os_->good();
+	}
+
+	// Writes out what is buffered.  Needed before writing to the ostream
+	// other than through us.
+	bool Flush()
+	{
+		if (os_ && used_)
+		{
+			os_->write(buffer_, used_);
+			used_ = 0;
+		}
+		return Good();
 	}
 
 	template <typename T>
@@ -97,17 +184,31 @@ public:
 
 	bool Write(const void* buffer, int32_t num_bytes)
 	{
-		// exit on pre-existing errors
-		if (!os_.good())
-			return false;
+		const char* bytes = reinterpret_cast<const char *>(buffer);
+		if (block_)
+		{
+			block_->insert(block_->end(), bytes, bytes + num_bytes);
+			return true;
+		}
 
-		// if a request of non-zero length was made
-		if (0 != num_bytes)
+		if (num_bytes <= kBufferSize - used_)
 		{
-			os_.write(reinterpret_cast<const char *>(buffer), num_bytes);
-			return os_.good();
+			if (0 != num_bytes)
+				memcpy(buffer_ + used_, bytes, num_bytes);
+			used_ += num_bytes;
+			return os_->good();
 		}
 
+		// large writes skip the buffer
+		if (!Flush())
+			return false;
+		if (num_bytes >= kBufferSize)
+		{
+			os_->write(bytes, num_bytes);
+			return os_->good();
+		}
+		memcpy(buffer_, bytes, num_bytes);
+		used_ = num_bytes;
 		return true;
 	}
 
@@ -123,7 +224,10 @@ public:
 	}
 
 private:
-	std::ostream& os_;
+	std::ostream* os_;
+	std::vector<char>* block_;
+	int32_t used_;
+	char buffer_[kBufferSize];
 };
 
 } // namespace DTS
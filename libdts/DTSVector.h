@@ -18,6 +18,15 @@ T* Address(std::vector<T>& vector)
 	return vector.data();
 }
 
+template<class T>
+const T* Address(const std::vector<T>& vector)
+{
+	if (vector.empty())
+		return nullptr;
+
+	return vector.data();
+}
+
 template<class T>
 void Insert(std::vector<T>& vector, std::size_t index)
 {
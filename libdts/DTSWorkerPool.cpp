@@ -0,0 +1,86 @@
+#include "DTSWorkerPool.h"
+
+#include <algorithm>
+
+namespace DTS
+{
+
+TSWorkerPool::TSWorkerPool(int32_t threads) :
+	task_(nullptr), num_tasks_(0), next_(0), busy_(0), run_count_(0), quit_(false)
+{
+	if (threads <= 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (int32_t t = 1; t < threads; t++)
+		workers_.emplace_back(&TSWorkerPool::Work, this);
+}
+
+TSWorkerPool::~TSWorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		quit_ = true;
+	}
+	start_.notify_all();
+
+	for (std::thread& worker : workers_)
+		worker.join();
+}
+
+void TSWorkerPool::Run(int32_t num_tasks, const std::function<void(int32_t)>& task)
+{
+	if (num_tasks <= 0)
+		return;
+
+	std::lock_guard<std::mutex> run_lock(run_mutex_);
+	if (workers_.empty() || num_tasks == 1)
+	{
+		for (int32_t i = 0; i < num_tasks; i++)
+			task(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		task_ = &task;
+		num_tasks_ = num_tasks;
+		next_ = 0;
+		busy_ = static_cast<int32_t>(workers_.size());
+		run_count_++;
+	}
+	start_.notify_all();
+
+	// each thread takes the next task not yet taken
+	for (int32_t i = next_++; i < num_tasks; i = next_++)
+		task(i);
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	done_.wait(lock, [this]() { return busy_ == 0; });
+	task_ = nullptr;
+}
+
+void TSWorkerPool::Work()
+{
+	uint32_t seen = 0;
+	std::unique_lock<std::mutex> lock(mutex_);
+	for (;;)
+	{
+		start_.wait(lock, [&]() { return quit_ || run_count_ != seen; });
+		if (quit_)
+			return;
+
+		seen = run_count_;
+		const std::function<void(int32_t)>& task = *task_;
+		const int32_t num_tasks = num_tasks_;
+		lock.unlock();
+
+		for (int32_t i = next_++; i < num_tasks; i = next_++)
+			task(i);
+
+		lock.lock();
+		if (--busy_ == 0)
+			done_.notify_one();
+	}
+}
+
+} // namespace DTS
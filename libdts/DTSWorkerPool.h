@@ -0,0 +1,54 @@
+#ifndef DTS_WORKERPOOL_H_
+#define DTS_WORKERPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace DTS
+{
+
+// Threads started once and kept waiting, for work that is run every frame
+// where starting threads each time would cost more than the work.
+class TSWorkerPool
+{
+public:
+	// threads counts the calling thread, so threads - 1 are started
+	// (0 for one per core)
+	explicit TSWorkerPool(int32_t threads = 0);
+	~TSWorkerPool();
+
+	int32_t GetNumThreads() const { return static_cast<int32_t>(workers_.size()) + 1; }
+
+	// Runs task(0) to task(num_tasks - 1) between the pool's threads and the
+	// calling one, and returns once they are all done.  Calls from several
+	// threads take turns.
+	void Run(int32_t num_tasks, const std::function<void(int32_t)>& task);
+
+private:
+	TSWorkerPool(const TSWorkerPool&);
+	TSWorkerPool& operator=(const TSWorkerPool&);
+
+	void Work();
+
+	std::vector<std::thread> workers_;
+	std::mutex run_mutex_; // one Run at a time
+
+	std::mutex mutex_;
+	std::condition_variable start_;
+	std::condition_variable done_;
+	const std::function<void(int32_t)>* task_;
+	int32_t num_tasks_;
+	std::atomic<int32_t> next_;
+	int32_t busy_;       // workers not yet done with this run
+	uint32_t run_count_; // tells the workers a new run has started
+	bool quit_;
+};
+
+} // namespace DTS
+
+#endif // DTS_WORKERPOOL_H_
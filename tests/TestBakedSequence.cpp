@@ -0,0 +1,98 @@
+// Checks baked sequences against sampling the shape: each baked keyframe is
+// the world pose SampleKeyframes gives, blending lands between keyframes,
+// sidecars load back as written, and sequences that can't be baked aren't.
+
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include "DTSBakedSequence.h"
+#include "TestUtil.h"
+
+using namespace DTS;
+using namespace DTS::Test;
+
+namespace
+{
+
+bool Near(const MatrixF& a, const MatrixF& b, float eps)
+{
+	const float* x = a;
+	const float* y = b;
+	for (int32_t i = 0; i < 12; i++)
+	{
+		if (fabsf(x[i] - y[i]) > eps)
+			return false;
+	}
+	return true;
+}
+
+} // namespace
+
+int main()
+{
+	TSShape* shape = MakeShape(10);
+	const int32_t num_nodes = static_cast<int32_t>(shape->nodes_.size());
+
+	// a blend copy of the sequence, which can't be baked
+	TSShape::Sequence blend = shape->sequences_[0];
+	blend.name_index_ = shape->AddName("blend");
+	blend.flags_ |= TSShape::kBlend;
+	shape->sequences_.push_back(blend);
+
+	std::vector<TSBakedSequence> baked;
+	BakeSequences(*shape, &baked, 2);
+	DTS_CHECK(baked.size() == 2);
+	DTS_CHECK(baked[1].GetNumKeyframes() == 0);
+
+	const TSBakedSequence& run = baked[0];
+	DTS_CHECK(run.GetNumNodes() == num_nodes && run.GetNumKeyframes() == shape->sequences_[0].num_keyframes_);
+
+	std::vector<MatrixF> local, world, baked_world;
+	for (int32_t k = 0; k < run.GetNumKeyframes(); k++)
+	{
+		DTS_CHECK(shape->SampleKeyframes(0, k, k, 0.0f, &local));
+		shape->GetWorldTransforms(local, &world);
+		TSBakedSequence::GetWorldTransforms(run.GetRow(k), num_nodes, &baked_world);
+		DTS_CHECK(static_cast<int32_t>(baked_world.size()) == num_nodes);
+		for (int32_t i = 0; i < num_nodes; i++)
+			DTS_CHECK(Near(baked_world[i], world[i], 1e-5f));
+	}
+
+	// halfway between two keyframes is halfway between their rows
+	float duration = shape->sequences_[0].duration_;
+	float time = duration * 0.5f / run.GetNumKeyframes();
+	std::vector<float> pose(run.GetRowSize());
+	run.Blend(time, &pose[0]);
+	const float* row1 = run.GetRow(0);
+	const float* row2 = run.GetRow(1);
+	for (int32_t i = 0; i < run.GetRowSize(); i++)
+		DTS_CHECK(fabsf(pose[i] - (row1[i] + row2[i]) * 0.5f) < 1e-5f);
+
+	// sidecars
+	std::ostringstream os(std::ios::binary);
+	DTS_CHECK(run.WriteToStream(os));
+	TSBakedSequence loaded;
+	std::istringstream is(os.str(), std::ios::binary);
+	DTS_CHECK(loaded.LoadFromStream(is, *shape));
+	DTS_CHECK(loaded.GetNumKeyframes() == run.GetNumKeyframes());
+	for (int32_t k = 0; k < run.GetNumKeyframes(); k++)
+		DTS_CHECK(memcmp(loaded.GetRow(k), run.GetRow(k), run.GetRowSize() * sizeof(float)) == 0);
+
+	std::string truncated = os.str();
+	truncated.resize(truncated.size() - 1);
+	std::istringstream truncated_is(truncated, std::ios::binary);
+	TSBakedSequence untouched;
+	DTS_CHECK(!untouched.LoadFromStream(truncated_is, *shape) && untouched.GetNumKeyframes() == 0);
+
+	// keys that run past the shape's can't be sampled, so aren't baked
+	TSShape::Sequence bad = shape->sequences_[0];
+	bad.base_rotation_ = static_cast<int32_t>(shape->node_rotations_.size());
+	shape->sequences_.push_back(bad);
+	TSBakedSequence bad_baked;
+	DTS_CHECK(!bad_baked.Bake(*shape, static_cast<int32_t>(shape->sequences_.size()) - 1));
+	DTS_CHECK(bad_baked.GetNumKeyframes() == 0);
+
+	delete shape;
+	return 0;
+}
@@ -0,0 +1,80 @@
+// Checks the batch quaternion kernels against the scalar code they fall back
+// on.  A kernel asked for a single key has no lanes to fill and takes the
+// scalar path, so each key is run again on its own and compared.  Built
+// with DTS_NO_SIMD both are the scalar code.
+
+#include <algorithm>
+#include <vector>
+
+#include "DTSQuat.h"
+#include "TestUtil.h"
+
+using namespace DTS;
+
+namespace
+{
+
+const int32_t kNumKeys = 1003; // not a multiple of any lane count
+const int32_t kStride = 3;
+
+typedef void (*QuatKernel)(const Quat16* q1, const Quat16* q2, int32_t stride, float t, QuatF* out, int32_t count);
+
+void Decode(const Quat16* q1, const Quat16*, int32_t stride, float, QuatF* out, int32_t count)
+{
+	DecodeQuats(q1, stride, out, count);
+}
+
+float MaxDifference(QuatKernel kernel, const std::vector<Quat16>& q1, const std::vector<Quat16>& q2, float t)
+{
+	std::vector<QuatF> batch(kNumKeys);
+	kernel(&q1[0], &q2[0], kStride, t, &batch[0], kNumKeys);
+
+	float max_diff = 0.0f;
+	for (int32_t i = 0; i < kNumKeys; i++)
+	{
+		QuatF scalar;
+		kernel(&q1[i * kStride], &q2[i * kStride], kStride, t, &scalar, 1);
+		max_diff = std::max(max_diff, fabsf(batch[i].x - scalar.x));
+		max_diff = std::max(max_diff, fabsf(batch[i].y - scalar.y));
+		max_diff = std::max(max_diff, fabsf(batch[i].z - scalar.z));
+		max_diff = std::max(max_diff, fabsf(batch[i].w - scalar.w));
+	}
+	return max_diff;
+}
+
+} // namespace
+
+int main()
+{
+	// key pairs in opposite hemispheres, nearly equal, and unrelated
+	std::vector<Quat16> q1(kNumKeys * kStride), q2(kNumKeys * kStride);
+	for (int32_t i = 0; i < kNumKeys * kStride; i++)
+	{
+		QuatF a(sinf(i * 1.3f), cosf(i * 0.7f), sinf(i * 0.11f + 1.0f), cosf(i * 2.1f));
+		a.Normalize();
+		QuatF b;
+		if (i % 5 == 0)
+			b.Set(-a.x, -a.y, -a.z, -a.w);
+		else if (i % 7 == 0)
+			b.Set(a.x + 1e-4f, a.y, a.z, a.w);
+		else
+			b.Set(cosf(i * 0.3f), sinf(i * 0.9f), 0.2f, 0.5f);
+		b.Normalize();
+		q1[i].Set(a);
+		q2[i].Set(b);
+	}
+
+	const QuatKernel kernels[] = { Decode, NlerpQuats, SlerpQuats };
+	const char* names[] = { "DecodeQuats", "NlerpQuats", "SlerpQuats" };
+	const float times[] = { 0.0f, 0.25f, 0.5f, 0.999f, 1.0f };
+	for (int32_t k = 0; k < 3; k++)
+	{
+		float max_diff = 0.0f;
+		for (float t : times)
+			max_diff = std::max(max_diff, MaxDifference(kernels[k], q1, q2, t));
+		printf("%s: largest difference %g\n", names[k], max_diff);
+		DTS_CHECK(max_diff < 1e-5f);
+	}
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+// Checks that removing nodes, sequences and meshes remaps what is left:
+// each remaining node keeps its keys, children and skin bones move to the
+// removed node's parent, and the shape saves and loads the same afterwards.
+
+#include "TestUtil.h"
+
+using namespace DTS;
+using namespace DTS::Test;
+
+namespace
+{
+
+const int32_t kNoKey = -99999;
+
+// The w of a node's rotation key in a sequence, or kNoKey if it has none
+int32_t RotationKey(const TSShape* shape, const std::string& seq_name, const std::string& node_name, int32_t keyframe)
+{
+	int32_t seq_index = shape->FindSequence(seq_name);
+	int32_t node = shape->FindNode(node_name);
+	if (seq_index < 0 || node < 0)
+		return kNoKey;
+
+	const TSShape::Sequence& seq = shape->sequences_[seq_index];
+	if (!seq.rotation_matters_.Test(node))
+		return kNoKey;
+
+	int32_t row = 0;
+	for (int32_t i = seq.rotation_matters_.Start(); i >= 0 && i < node; i = seq.rotation_matters_.Next(i))
+		row++;
+	return shape->node_rotations_[seq.base_rotation_ + row * seq.num_keyframes_ + keyframe].w;
+}
+
+void CheckRoundTrip(TSShape* shape)
+{
+	std::string bytes = Save(shape);
+	TSShape* loaded = Load(bytes);
+	DTS_CHECK(Save(loaded) == bytes);
+	delete loaded;
+}
+
+} // namespace
+
+int main()
+{
+	TSShape* shape = MakeShape(6);
+
+	// a second sequence rotating hand, n2 and n4, its keys tagged by node and keyframe
+	TSShape::Sequence walk = shape->sequences_[0];
+	walk.name_index_ = shape->AddName("walk");
+	walk.rotation_matters_.ClearAll();
+	walk.translation_matters_.ClearAll();
+	walk.num_keyframes_ = 4;
+	walk.base_rotation_ = static_cast<int32_t>(shape->node_rotations_.size());
+	walk.base_translation_ = static_cast<int32_t>(shape->node_translations_.size());
+	int32_t walk_nodes[] = { shape->FindNode("hand"), shape->FindNode("n2"), shape->FindNode("n4") };
+	for (int32_t n = 0; n < 3; n++)
+	{
+		walk.rotation_matters_.Insert(walk_nodes[n], true);
+		for (int32_t k = 0; k < walk.num_keyframes_; k++)
+		{
+			Quat16 key;
+			key.x = key.y = key.z = 0;
+			key.w = static_cast<int16_t>(1000 + n * 10 + k);
+			shape->node_rotations_.push_back(key);
+		}
+	}
+	shape->sequences_.push_back(walk);
+	for (int32_t i = 0; i < 6; i++)
+		shape->node_rotations_[i].w = static_cast<int16_t>(2000 + i);
+
+	const int32_t n2_key = RotationKey(shape, "walk", "n2", 3);
+	const int32_t n4_key = RotationKey(shape, "walk", "n4", 1);
+	const int32_t hand_key = RotationKey(shape, "run", "hand", 2);
+	DTS_CHECK(n2_key == 1013 && n4_key == 1021 && hand_key == 2005);
+
+	// a node no sequence animates
+	int32_t num_nodes = static_cast<int32_t>(shape->nodes_.size());
+	int32_t num_rotations = static_cast<int32_t>(shape->node_rotations_.size());
+	DTS_CHECK(shape->RemoveNode("n3"));
+	DTS_CHECK(static_cast<int32_t>(shape->nodes_.size()) == num_nodes - 1);
+	DTS_CHECK(static_cast<int32_t>(shape->node_rotations_.size()) == num_rotations);
+	DTS_CHECK(shape->FindNode("n3") < 0 && shape->FindName("n3") < 0);
+	DTS_CHECK(shape->nodes_[shape->FindNode("n4")].parent_index == shape->FindNode("n2"));
+	DTS_CHECK(RotationKey(shape, "walk", "n2", 3) == n2_key && RotationKey(shape, "walk", "n4", 1) == n4_key);
+	CheckRoundTrip(shape);
+
+	// an animated node takes its keys with it
+	DTS_CHECK(shape->RemoveNode("n2"));
+	DTS_CHECK(static_cast<int32_t>(shape->node_rotations_.size()) == num_rotations - 4);
+	DTS_CHECK(RotationKey(shape, "walk", "n4", 1) == n4_key && RotationKey(shape, "run", "hand", 2) == hand_key);
+	CheckRoundTrip(shape);
+
+	// a node with an object and a skin bone on it
+	DTS_CHECK(shape->RemoveNode("arm"));
+	DTS_CHECK(shape->objects_[shape->FindObject("Box")].node_index == shape->FindNode("root"));
+	DTS_CHECK(shape->nodes_[shape->FindNode("hand")].parent_index == shape->FindNode("root"));
+	DTS_CHECK(RotationKey(shape, "run", "hand", 2) == hand_key && RotationKey(shape, "walk", "n4", 1) == n4_key);
+	const TSShape::Object& skin_object = shape->objects_[shape->FindObject("Skin")];
+	const TSSkinMesh* skin = dynamic_cast<const TSSkinMesh*>(shape->meshes_[skin_object.start_mesh_index]);
+	DTS_CHECK(skin && skin->node_index_[0] == 0 && skin->node_index_[1] == 0);
+	CheckRoundTrip(shape);
+
+	// sequences
+	DTS_CHECK(shape->RemoveSequence("run"));
+	DTS_CHECK(shape->sequences_.size() == 1 && shape->FindSequence("walk") == 0 && shape->FindName("run") < 0);
+	DTS_CHECK(RotationKey(shape, "walk", "n4", 1) == n4_key);
+	DTS_CHECK(shape->node_translations_.empty());
+	CheckRoundTrip(shape);
+
+	// meshes, objects and details
+	DTS_CHECK(shape->RemoveMesh("Box8"));
+	DTS_CHECK(!shape->RemoveMesh("Box8"));
+	DTS_CHECK(shape->objects_[shape->FindObject("Box")].num_meshes == 1);
+	int32_t num_meshes = static_cast<int32_t>(shape->meshes_.size()) - shape->objects_[shape->FindObject("Col")].num_meshes;
+	DTS_CHECK(shape->RemoveObject("Col"));
+	DTS_CHECK(static_cast<int32_t>(shape->meshes_.size()) == num_meshes && shape->FindObject("Col") < 0);
+	CheckRoundTrip(shape);
+	DTS_CHECK(shape->RemoveDetail(64));
+	DTS_CHECK(shape->meshes_.empty() && shape->objects_.empty());
+	CheckRoundTrip(shape);
+
+	delete shape;
+	return 0;
+}
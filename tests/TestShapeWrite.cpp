@@ -0,0 +1,58 @@
+// Checks the streaming shape writer: the bytes don't depend on the thread
+// count or on write caching, and what is written loads back and saves the
+// same again.
+
+#include "TestUtil.h"
+
+using namespace DTS;
+using namespace DTS::Test;
+
+int main()
+{
+	// enough meshes for several windows of them at a time
+	TSShape* shape = MakeShape(3, 3000);
+	for (int32_t i = 0; i < 20; i++)
+		shape->AddMesh(MakeMesh(300 + i * 50, static_cast<float>(i), (i & 1) != 0), "Extra" + std::to_string(i) + "64");
+
+	std::string bytes = Save(shape, 1);
+	DTS_CHECK(Save(shape, 4) == bytes);
+	DTS_CHECK(Save(shape, 0) == bytes);
+
+	TSShape* loaded = Load(bytes);
+	DTS_CHECK(loaded->meshes_.size() == shape->meshes_.size());
+	DTS_CHECK(loaded->nodes_.size() == shape->nodes_.size());
+	DTS_CHECK(loaded->names_ == shape->names_);
+	DTS_CHECK(Save(loaded, 3) == bytes);
+	delete loaded;
+
+	// cached meshes are written as read; a changed one is written anew
+	TSShape::LoadOptions options;
+	options.cache_writes = true;
+	TSShape* cached = Load(bytes, options);
+	DTS_CHECK(Save(cached, 2) == bytes);
+
+	int32_t changed = -1;
+	for (int32_t i = 0; i < static_cast<int32_t>(cached->meshes_.size()) && changed < 0; i++)
+	{
+		if (cached->meshes_[i] && !cached->meshes_[i]->verts_.empty())
+			changed = i;
+	}
+	DTS_CHECK(changed >= 0);
+	DTS_CHECK(!cached->meshes_[changed]->IsDirty());
+	cached->meshes_[changed]->verts_[0] = Point3F(42.0f, 43.0f, 44.0f);
+	cached->meshes_[changed]->SetDirty();
+
+	std::string changed_bytes = Save(cached, 2);
+	DTS_CHECK(changed_bytes != bytes);
+	DTS_CHECK(!cached->meshes_[changed]->IsDirty());
+	DTS_CHECK(Save(cached, 1) == changed_bytes);
+
+	TSShape* reloaded = Load(changed_bytes);
+	DTS_CHECK(reloaded->meshes_[changed]->verts_[0].x == 42.0f);
+	DTS_CHECK(Save(reloaded) == changed_bytes);
+
+	delete reloaded;
+	delete cached;
+	delete shape;
+	return 0;
+}
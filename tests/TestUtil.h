@@ -0,0 +1,161 @@
+#ifndef DTS_TESTUTIL_H_
+#define DTS_TESTUTIL_H_
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#include "DTSMaterialList.h"
+#include "DTSShape.h"
+#include "DTSSortedMesh.h"
+
+// Fails the test with the condition and where it was
+#define DTS_CHECK(x) \
+	do \
+	{ \
+		if (!(x)) \
+		{ \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+			exit(1); \
+		} \
+	} while (0)
+
+namespace DTS
+{
+
+namespace Test
+{
+
+// A triangle strip mesh of num_verts vertices, skinned (to the first of two
+// bones) if skin
+inline TSMesh* MakeMesh(int32_t num_verts, float offset, bool skin = false)
+{
+	TSMesh* mesh = skin ? new TSSkinMesh : new TSMesh;
+	mesh->num_frames_ = 1;
+	mesh->num_mat_frames_ = 1;
+	mesh->verts_per_frame_ = num_verts;
+
+	for (int32_t i = 0; i < num_verts; i++)
+	{
+		mesh->verts_.push_back(Point3F(offset + i, i * 0.5f, -static_cast<float>(i)));
+		Point3F normal(sinf(i * 0.7f), cosf(i * 1.3f), sinf(i * 0.3f + 1.0f));
+		normal.Normalize();
+		mesh->norms_.push_back(normal);
+		Point2F tvert;
+		tvert.Set(i * 0.1f, i * 0.2f);
+		mesh->tverts_.push_back(tvert);
+	}
+	for (int32_t i = 0; i < num_verts; i++)
+		mesh->indices_.push_back(i);
+
+	TSDrawPrimitive prim;
+	prim.start = 0;
+	prim.num_elements = static_cast<int32_t>(mesh->indices_.size());
+	prim.mat_index = TSDrawPrimitive::kStrip | TSDrawPrimitive::kIndexed;
+	mesh->primitives_.push_back(prim);
+
+	if (skin)
+	{
+		TSSkinMesh* skin_mesh = static_cast<TSSkinMesh*>(mesh);
+		skin_mesh->initial_verts_ = mesh->verts_;
+		skin_mesh->initial_norms_ = mesh->norms_;
+		skin_mesh->node_index_.push_back(0);
+		skin_mesh->node_index_.push_back(1);
+		MatrixF mat(true);
+		skin_mesh->initial_transforms_.push_back(mat);
+		mat.SetPosition(Point3F(1.0f, 2.0f, 3.0f));
+		skin_mesh->initial_transforms_.push_back(mat);
+		for (int32_t i = 0; i < num_verts; i++)
+		{
+			skin_mesh->vertex_index_.push_back(i);
+			skin_mesh->bone_index_.push_back(0);
+			skin_mesh->weight_.push_back(1.0f);
+		}
+	}
+
+	mesh->ComputeBounds();
+	return mesh;
+}
+
+// A shape with a chain of nodes, a few meshes and a sequence rotating the
+// second and third nodes
+inline TSShape* MakeShape(int32_t extra_nodes = 0, int32_t mesh_verts = 30)
+{
+	TSShape* shape = new TSShape;
+	shape->material_list_ = new TSMaterialList;
+	shape->sub_shape_first_node_.push_back(0);
+	shape->sub_shape_first_object_.push_back(0);
+	shape->sub_shape_num_nodes_.push_back(0);
+	shape->sub_shape_num_objects_.push_back(0);
+	shape->radius_ = 5.0f;
+	shape->tube_radius_ = 4.0f;
+	shape->center_ = Point3F(0.0f, 0.0f, 0.0f);
+	shape->bounds_.min_extents = Point3F(-1.0f, -1.0f, -1.0f);
+	shape->bounds_.max_extents = Point3F(1.0f, 1.0f, 1.0f);
+
+	QuatF rot(0.1f, 0.2f, 0.3f, 0.9f);
+	rot.Normalize();
+	shape->AddNode("root", "", Point3F(0.0f, 0.0f, 0.0f), QuatF::kIdentity);
+	shape->AddNode("arm", "root", Point3F(1.0f, 0.0f, 0.0f), rot);
+	shape->AddNode("hand", "arm", Point3F(0.0f, 1.0f, 0.0f), rot);
+	for (int32_t i = 0; i < extra_nodes; i++)
+	{
+		std::string parent = i ? "n" + std::to_string(i - 1) : "hand";
+		shape->AddNode("n" + std::to_string(i), parent, Point3F(0.1f * i, 0.0f, 1.0f), rot);
+	}
+
+	shape->AddMesh(MakeMesh(mesh_verts, 0.0f), "Box64");
+	shape->AddMesh(MakeMesh(mesh_verts / 2, 1.0f), "Box8");
+	shape->AddMesh(MakeMesh(12, 2.0f, true), "Skin64");
+	shape->AddMesh(MakeMesh(9, 3.0f), "Col-1");
+	shape->SetObjectNode("Box", "arm");
+	shape->SetObjectNode("Col", "root");
+
+	TSShape::Sequence seq = TSShape::Sequence(); // zeroed
+	seq.name_index_ = shape->AddName("run");
+	seq.num_keyframes_ = 3;
+	seq.duration_ = 1.0f;
+	seq.flags_ = TSShape::kCyclic;
+	seq.rotation_matters_.Insert(1, true);
+	seq.rotation_matters_.Insert(2, true);
+	seq.translation_matters_.Insert(1, true);
+	for (int32_t node = 0; node < 2; node++)
+	{
+		for (int32_t k = 0; k < seq.num_keyframes_; k++)
+		{
+			QuatF key(0.1f * k, 0.3f * node, 0.05f, 1.0f);
+			key.Normalize();
+			Quat16 key16;
+			key16.Set(key);
+			shape->node_rotations_.push_back(key16);
+		}
+	}
+	for (int32_t k = 0; k < seq.num_keyframes_; k++)
+		shape->node_translations_.push_back(Point3F(1.0f + k, 0.0f, 0.0f));
+	shape->sequences_.push_back(seq);
+
+	return shape;
+}
+
+inline std::string Save(TSShape* shape, int32_t threads = 1)
+{
+	std::ostringstream os(std::ios::binary);
+	DTS_CHECK(shape->WriteToStream(os, threads));
+	return os.str();
+}
+
+inline TSShape* Load(const std::string& bytes, const TSShape::LoadOptions& options = TSShape::LoadOptions())
+{
+	std::istringstream is(bytes, std::ios::binary);
+	TSShape* shape = new TSShape;
+	DTS_CHECK(shape->LoadFromStream(is, options));
+	return shape;
+}
+
+} // namespace Test
+
+} // namespace DTS
+
+#endif // DTS_TESTUTIL_H_